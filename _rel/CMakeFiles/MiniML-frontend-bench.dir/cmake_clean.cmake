@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/MiniML-frontend-bench.dir/frontend_bench.cc.o"
+  "CMakeFiles/MiniML-frontend-bench.dir/frontend_bench.cc.o.d"
+  "MiniML-frontend-bench"
+  "MiniML-frontend-bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/MiniML-frontend-bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
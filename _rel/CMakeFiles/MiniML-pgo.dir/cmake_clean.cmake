@@ -0,0 +1,8 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/MiniML-pgo"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang )
+  include(CMakeFiles/MiniML-pgo.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/MiniML.dir/miniml.cc.o"
+  "CMakeFiles/MiniML.dir/miniml.cc.o.d"
+  "MiniML"
+  "MiniML.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/MiniML.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
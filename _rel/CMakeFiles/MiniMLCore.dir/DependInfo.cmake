@@ -0,0 +1,38 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/astcache.cc" "CMakeFiles/MiniMLCore.dir/astcache.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/astcache.cc.o.d"
+  "/root/repo/builtin.cc" "CMakeFiles/MiniMLCore.dir/builtin.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/builtin.cc.o.d"
+  "/root/repo/emitcpp.cc" "CMakeFiles/MiniMLCore.dir/emitcpp.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/emitcpp.cc.o.d"
+  "/root/repo/escape.cc" "CMakeFiles/MiniMLCore.dir/escape.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/escape.cc.o.d"
+  "/root/repo/eval.cc" "CMakeFiles/MiniMLCore.dir/eval.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/eval.cc.o.d"
+  "/root/repo/gc.cc" "CMakeFiles/MiniMLCore.dir/gc.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/gc.cc.o.d"
+  "/root/repo/image.cc" "CMakeFiles/MiniMLCore.dir/image.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/image.cc.o.d"
+  "/root/repo/incremental.cc" "CMakeFiles/MiniMLCore.dir/incremental.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/incremental.cc.o.d"
+  "/root/repo/inputstream.cc" "CMakeFiles/MiniMLCore.dir/inputstream.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/inputstream.cc.o.d"
+  "/root/repo/interpreter.cc" "CMakeFiles/MiniMLCore.dir/interpreter.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/interpreter.cc.o.d"
+  "/root/repo/jit.cc" "CMakeFiles/MiniMLCore.dir/jit.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/jit.cc.o.d"
+  "/root/repo/lift.cc" "CMakeFiles/MiniMLCore.dir/lift.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/lift.cc.o.d"
+  "/root/repo/module.cc" "CMakeFiles/MiniMLCore.dir/module.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/module.cc.o.d"
+  "/root/repo/output.cc" "CMakeFiles/MiniMLCore.dir/output.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/output.cc.o.d"
+  "/root/repo/parallel.cc" "CMakeFiles/MiniMLCore.dir/parallel.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/parallel.cc.o.d"
+  "/root/repo/parser.cc" "CMakeFiles/MiniMLCore.dir/parser.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/parser.cc.o.d"
+  "/root/repo/slab.cc" "CMakeFiles/MiniMLCore.dir/slab.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/slab.cc.o.d"
+  "/root/repo/text.cc" "CMakeFiles/MiniMLCore.dir/text.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/text.cc.o.d"
+  "/root/repo/tokenstream.cc" "CMakeFiles/MiniMLCore.dir/tokenstream.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/tokenstream.cc.o.d"
+  "/root/repo/vector.cc" "CMakeFiles/MiniMLCore.dir/vector.cc.o" "gcc" "CMakeFiles/MiniMLCore.dir/vector.cc.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
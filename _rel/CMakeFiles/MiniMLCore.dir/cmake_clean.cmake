@@ -0,0 +1,47 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/MiniMLCore.dir/astcache.cc.o"
+  "CMakeFiles/MiniMLCore.dir/astcache.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/builtin.cc.o"
+  "CMakeFiles/MiniMLCore.dir/builtin.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/emitcpp.cc.o"
+  "CMakeFiles/MiniMLCore.dir/emitcpp.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/escape.cc.o"
+  "CMakeFiles/MiniMLCore.dir/escape.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/eval.cc.o"
+  "CMakeFiles/MiniMLCore.dir/eval.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/gc.cc.o"
+  "CMakeFiles/MiniMLCore.dir/gc.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/image.cc.o"
+  "CMakeFiles/MiniMLCore.dir/image.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/incremental.cc.o"
+  "CMakeFiles/MiniMLCore.dir/incremental.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/inputstream.cc.o"
+  "CMakeFiles/MiniMLCore.dir/inputstream.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/interpreter.cc.o"
+  "CMakeFiles/MiniMLCore.dir/interpreter.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/jit.cc.o"
+  "CMakeFiles/MiniMLCore.dir/jit.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/lift.cc.o"
+  "CMakeFiles/MiniMLCore.dir/lift.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/module.cc.o"
+  "CMakeFiles/MiniMLCore.dir/module.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/output.cc.o"
+  "CMakeFiles/MiniMLCore.dir/output.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/parallel.cc.o"
+  "CMakeFiles/MiniMLCore.dir/parallel.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/parser.cc.o"
+  "CMakeFiles/MiniMLCore.dir/parser.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/slab.cc.o"
+  "CMakeFiles/MiniMLCore.dir/slab.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/text.cc.o"
+  "CMakeFiles/MiniMLCore.dir/text.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/tokenstream.cc.o"
+  "CMakeFiles/MiniMLCore.dir/tokenstream.cc.o.d"
+  "CMakeFiles/MiniMLCore.dir/vector.cc.o"
+  "CMakeFiles/MiniMLCore.dir/vector.cc.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/MiniMLCore.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,24 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_rel
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(unit "/root/repo/_rel/MiniML" "test")
+set_tests_properties(unit PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;80;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(corpus "/root/repo/_rel/MiniML" "test" "tests")
+set_tests_properties(corpus PROPERTIES  WORKING_DIRECTORY "/root/repo" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;81;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/collatz.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=collatz.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/collatz.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/divzero.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=divzero.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/divzero.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/error.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=error.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/error.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/fib.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=fib.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/fib.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/mutual.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=mutual.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/mutual.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/pairs.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=pairs.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/pairs.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(emit-cpp/use.sml "/usr/bin/cmake" "-DMINIML=/root/repo/_rel/MiniML" "-DSOURCE=/root/repo" "-DCXX=/usr/bin/c++" "-DPROGRAM=use.sml" "-DWORK=/root/repo/_rel/emit-cpp" "-P" "/root/repo/cmake/emitcpp.cmake")
+set_tests_properties(emit-cpp/use.sml PROPERTIES  WORKING_DIRECTORY "/root/repo/tests" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
@@ -0,0 +1,322 @@
+#include "astcache.h"
+#include "builtin.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MINIML_VERSION
+#define MINIML_VERSION "unknown"
+#endif
+
+AstCacheOptions AST_CACHE;
+
+// The file is a header, the nodes in preorder, then every string the nodes
+// refer to, back to back.
+struct CacheHeader {
+  char magic[4];
+  uint32_t format;
+  uint64_t key;
+  uint32_t nodes;
+  uint32_t strings; // bytes
+};
+
+enum AstKind : uint8_t { KindBranch, KindLeaf, KindString };
+
+static const char CACHE_MAGIC[4] = {'M', 'L', 'A', 'C'};
+
+// cacheKey: FNV-1a over everything the parse depends on
+static uint64_t cacheKey(std::string const &sourcename,
+                         std::string const &source)
+{
+  uint64_t h = 14695981039346656037ull;
+  auto mix = [&h](std::string const &s) {
+    for (unsigned char c : s) {
+      h ^= c;
+      h *= 1099511628211ull;
+    }
+    h ^= 0xff; // separator, so ("ab","c") and ("a","bc") differ
+    h *= 1099511628211ull;
+  };
+  mix(MINIML_VERSION);
+  mix(std::to_string(AST_CACHE_FORMAT));
+  mix(sourcename);
+  mix(source);
+  return h;
+}
+
+static std::filesystem::path cacheDirectory(void)
+{
+  if (AST_CACHE.dir.size()) return AST_CACHE.dir;
+  if (const char *d = getenv("MINIML_CACHE_DIR")) return d;
+  if (const char *d = getenv("XDG_CACHE_HOME"))
+    return std::filesystem::path(d) / "miniml";
+  if (const char *d = getenv("HOME"))
+    return std::filesystem::path(d) / ".cache" / "miniml";
+  return "";
+}
+
+static std::filesystem::path cachePath(uint64_t key)
+{
+  std::filesystem::path dir = cacheDirectory();
+  if (dir.empty()) return dir;
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.mlast",
+           static_cast<unsigned long long>(key));
+  return dir / name;
+}
+
+// shape: The children a branch with label l has, as one letter each: B a
+// branch, D a declaration, F a Fun, L an int, bool or unit leaf, S a
+// string, V a leaf or a string. A letter followed by * may repeat any number
+// of times, none included. Null for labels only leaves have.
+static const char *shape(Label l)
+{
+  switch (l) {
+  case Label::If:
+    return "BBB";
+  case Label::Let:
+    return "DB";
+  case Label::Lam:
+  case Label::Val:
+    return "SB";
+  case Label::Fun:
+    return "SSB";
+  case Label::Funs:
+    return "FF*";
+  case Label::Or:
+  case Label::And:
+  case Label::Less:
+  case Label::Equals:
+  case Label::Plus:
+  case Label::Minus:
+  case Label::Concat:
+  case Label::Times:
+  case Label::Div:
+  case Label::Mod:
+  case Label::App:
+  case Label::PairUp:
+    return "BB";
+  case Label::Not:
+  case Label::Print:
+  case Label::First:
+  case Label::Second:
+    return "B";
+  case Label::Select:
+    return "BL";
+  case Label::Prim:
+    return "LB";
+  case Label::Literal:
+    return "V";
+  case Label::Tuple:
+    return "BBBB*";
+  case Label::Vec:
+  case Label::Program:
+    return "B*";
+  case Label::Seq:
+    return "BB*";
+  case Label::Var:
+  case Label::UseFile:
+    return "S";
+  default:
+    return nullptr;
+  }
+}
+
+static bool fits(char letter, std::shared_ptr<AstNode> child)
+{
+  Label l = child->label();
+  bool value = child->is_leaf() &&
+               (l == Label::Int || l == Label::Bool || l == Label::Unit);
+  switch (letter) {
+  case 'B':
+    return child->is_branch();
+  case 'D':
+    return child->is_branch() &&
+           (l == Label::Val || l == Label::Fun || l == Label::Funs);
+  case 'F':
+    return child->is_branch() && l == Label::Fun;
+  case 'L':
+    return value;
+  case 'S':
+    return child->is_string();
+  default:
+    return value || child->is_string();
+  }
+}
+
+// wellFormed: Whether a branch has the children eval expects of its label,
+// and in range where eval indexes by one, so that what a damaged file holds
+// is refused here rather than cast or indexed wrongly later
+static bool wellFormed(std::shared_ptr<AstBranch> b)
+{
+  const char *want = shape(b->label());
+  if (!want) return false;
+  int i = 0;
+  for (const char *c = want; *c; c++) {
+    if (c[1] == '*') {
+      while (i < b->count() && fits(*c, b->get(i)))
+        i++;
+      c++;
+    }
+    else if (i >= b->count() || !fits(*c, b->get(i++)))
+      return false;
+  }
+  if (i != b->count()) return false;
+  if (b->label() == Label::Select)
+    return std::static_pointer_cast<AstLeaf>(b->get(1))->val() >= 1;
+  if (b->label() == Label::Prim) {
+    int k = std::static_pointer_cast<AstLeaf>(b->get(0))->val();
+    return k >= 0 && k < static_cast<int>(Builtin::Count);
+  }
+  return true;
+}
+
+AstReader::AstReader(const AstRecord *records_, uint32_t count_,
+                     const char *strings_, uint32_t size_,
+                     std::vector<std::shared_ptr<AstNode>> *built_)
+    : records(records_), count(count_), strings(strings_), size(size_),
+      built(built_)
+{
+}
+
+std::shared_ptr<AstNode> AstReader::node(void)
+{
+  if (next >= count) throw std::out_of_range("AST records");
+  const AstRecord &r = records[next++];
+  if (r.label > Label::Program) throw std::out_of_range("AST label");
+  std::shared_ptr<AstNode> out;
+  if (r.kind == KindLeaf)
+    out = AstLeaf::New(r.value, static_cast<Label>(r.label));
+  else if (r.kind == KindString)
+    out = AstString::New(text(r));
+  else {
+    std::shared_ptr<AstBranch> b = std::shared_ptr<AstBranch>(new AstBranch);
+    b->label(static_cast<Label>(r.label));
+    b->where(text(r));
+    out = b;
+  }
+  if (built) built->push_back(out);
+  if (r.kind == KindBranch) {
+    std::shared_ptr<AstBranch> b = std::static_pointer_cast<AstBranch>(out);
+    for (int i = 0; i < r.value; i++)
+      b->add(node());
+    if (!wellFormed(b)) throw std::out_of_range("AST shape");
+  }
+  return out;
+}
+
+std::string AstReader::text(const AstRecord &r)
+{
+  if (r.str > size || r.len > size - r.str)
+    throw std::out_of_range("AST strings");
+  return std::string(strings + r.str, r.len);
+}
+
+std::shared_ptr<AstBranch> loadCachedProgram(std::string sourcename,
+                                             std::string const &source)
+{
+  uint64_t key = cacheKey(sourcename, source);
+  std::filesystem::path path = cachePath(key);
+  if (path.empty()) return nullptr;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(CacheHeader))
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return nullptr;
+
+  std::shared_ptr<AstBranch> out;
+  const CacheHeader *h = static_cast<const CacheHeader *>(map);
+  const char *base = static_cast<const char *>(map);
+  if (!memcmp(h->magic, CACHE_MAGIC, 4) && h->format == AST_CACHE_FORMAT &&
+      h->key == key &&
+      st.st_size == sizeof(CacheHeader) +
+                         uint64_t(h->nodes) * sizeof(AstRecord) + h->strings) {
+    AstReader reader(
+        reinterpret_cast<const AstRecord *>(base + sizeof(CacheHeader)),
+        h->nodes, base + sizeof(CacheHeader) + h->nodes * sizeof(AstRecord),
+        h->strings);
+    try {
+      std::shared_ptr<AstNode> root = reader.node();
+      if (reader.done() && root->label() == Label::Program)
+        out = std::dynamic_pointer_cast<AstBranch>(root);
+    }
+    catch (std::out_of_range &) {
+    }
+  }
+  munmap(map, st.st_size);
+  return out;
+}
+
+void flattenAst(std::shared_ptr<AstNode> node, std::vector<AstRecord> &records,
+                std::string &strings, std::vector<AstNode *> *order)
+{
+  AstRecord n{};
+  n.label = node->label();
+  auto text = [&n, &strings](std::string s) {
+    n.str = strings.size();
+    n.len = s.size();
+    strings += s;
+  };
+  std::shared_ptr<AstBranch> b;
+  if (node->is_leaf()) {
+    n.kind = KindLeaf;
+    n.value = std::dynamic_pointer_cast<AstLeaf>(node)->val();
+  }
+  else if (node->is_string()) {
+    n.kind = KindString;
+    text(std::dynamic_pointer_cast<AstString>(node)->get_string());
+  }
+  else {
+    b = std::dynamic_pointer_cast<AstBranch>(node);
+    n.kind = KindBranch;
+    n.value = b->count();
+    text(b->where());
+  }
+  records.push_back(n);
+  if (order) order->push_back(node.get());
+  for (int i = 0; b && i < b->count(); i++)
+    flattenAst(b->get(i), records, strings, order);
+}
+
+void saveCachedProgram(std::string sourcename, std::string const &source,
+                       std::shared_ptr<AstBranch> program)
+{
+  uint64_t key = cacheKey(sourcename, source);
+  std::filesystem::path path = cachePath(key);
+  if (path.empty()) return;
+  std::vector<AstRecord> nodes;
+  std::string strings;
+  flattenAst(program, nodes, strings);
+
+  CacheHeader h{};
+  memcpy(h.magic, CACHE_MAGIC, 4);
+  h.format = AST_CACHE_FORMAT;
+  h.key = key;
+  h.nodes = nodes.size();
+  h.strings = strings.size();
+
+  // written aside and renamed, so readers never see half a file
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  static std::atomic<int> saves{0};
+  std::filesystem::path tmp = path.string() + "." + std::to_string(getpid()) +
+                              "-" + std::to_string(saves++) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) return;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(nodes.data(), sizeof(AstRecord), nodes.size(), f) ==
+                nodes.size() &&
+            fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+  ok = fclose(f) == 0 && ok;
+  if (ok) std::filesystem::rename(tmp, path, ec);
+  if (!ok || ec) std::filesystem::remove(tmp, ec);
+}
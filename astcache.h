@@ -0,0 +1,71 @@
+#pragma once
+#include "parser.h"
+
+// Bump whenever the parser's output or the layout below changes
+const uint32_t AST_CACHE_FORMAT = 7;
+
+struct AstCacheOptions {
+  bool enabled{true};
+  std::string dir; // empty means $MINIML_CACHE_DIR, then ~/.cache/miniml
+};
+
+extern AstCacheOptions AST_CACHE;
+
+// AstRecord: one node of a tree written out in preorder. Strings live in a
+// separate block that records point into.
+struct AstRecord {
+  uint8_t label;
+  uint8_t kind;
+  uint16_t unused;
+  int32_t value; // child count for branches, the value for leaves
+  uint32_t str;  // the string, or a branch's position, as an offset...
+  uint32_t len;  // ...and length into the strings
+};
+
+// flattenAst: Appends the records for a tree
+//
+// std::shared_ptr<AstNode> node: the root
+// std::vector<AstRecord> &records: where the records go
+// std::string &strings: where their strings go
+// std::vector<AstNode *> *order: if given, receives the nodes in record order
+
+void flattenAst(std::shared_ptr<AstNode> node, std::vector<AstRecord> &records,
+                std::string &strings, std::vector<AstNode *> *order = nullptr);
+
+// AstReader: rebuilds trees from records, possibly several back to back,
+// throwing std::out_of_range on anything malformed, including a branch
+// whose children are not the number and kinds its label has
+class AstReader {
+    public:
+  AstReader(const AstRecord *records_, uint32_t count_, const char *strings_,
+            uint32_t size_, std::vector<std::shared_ptr<AstNode>> *built_ =
+                                nullptr);
+  std::shared_ptr<AstNode> node(void); // the next tree
+  bool done(void) { return next == count; }
+
+    private:
+  std::string text(const AstRecord &r);
+  const AstRecord *records;
+  uint32_t count;
+  const char *strings;
+  uint32_t size;
+  uint32_t next{0};
+  std::vector<std::shared_ptr<AstNode>> *built; // every node, in record order
+};
+
+// loadCachedProgram: The parsed program for a source, if an earlier run
+// stored one. The file is mapped rather than read and the tree is rebuilt
+// straight from fixed-size records.
+//
+// std::string sourcename: the name positions are reported against
+// std::string const &source: the program text
+//
+// return std::shared_ptr<AstBranch>: the Program node, nullptr on a miss
+
+std::shared_ptr<AstBranch> loadCachedProgram(std::string sourcename,
+                                             std::string const &source);
+
+// saveCachedProgram: Stores a parsed program for loadCachedProgram. Failure
+// to write is not an error; the next run just parses again.
+void saveCachedProgram(std::string sourcename, std::string const &source,
+                       std::shared_ptr<AstBranch> program);
@@ -0,0 +1,127 @@
+#include "builtin.h"
+
+SimdOptions SIMD;
+
+bool useAvx2(void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return SIMD.enabled && avx2;
+#else
+  return false;
+#endif
+}
+
+// Signature: a builtin's name, its arguments in words, and how many
+struct Signature {
+  const char *name;
+  const char *what;
+  int arity;
+};
+
+static const Signature SIGNATURES[] = {
+    {"Vector.length", "a vector", 1},
+    {"Vector.sub", "(vector, int)", 2},
+    {"Vector.tabulate", "(int, function)", 2},
+    {"Vector.map", "(function, vector)", 2},
+    {"Vector.foldl", "(function, value, vector)", 3},
+    {"Vector.filter", "(function, vector)", 2},
+    {"String.size", "a string", 1},
+    {"String.sub", "(string, int)", 2},
+    {"String.substring", "(string, int, int)", 3},
+    {"String.isSubstring", "(string, string)", 2},
+    {"String.str", "an int", 1}};
+
+Builtin builtinNamed(std::string name)
+{
+  for (int b = 0; b < static_cast<int>(Builtin::Count); b++)
+    if (name == SIGNATURES[b].name) return static_cast<Builtin>(b);
+  return Builtin::Count;
+}
+
+std::string builtinName(Builtin b)
+{
+  return SIGNATURES[static_cast<int>(b)].name;
+}
+
+static std::shared_ptr<AstBranch> branch(std::shared_ptr<AstNode> n)
+{
+  return n->is_branch() ? std::static_pointer_cast<AstBranch>(n) : nullptr;
+}
+
+// BuiltinCall::BuiltinCall: Evaluates the arguments, left to right. A pair
+// or tuple written in place is taken apart without being built.
+BuiltinCall::BuiltinCall(Environment &env, std::shared_ptr<AstBranch> ast_)
+    : ast(ast_)
+{
+  builtin = static_cast<Builtin>(
+      std::static_pointer_cast<AstLeaf>(ast->get(0))->val());
+  int n = SIGNATURES[static_cast<int>(builtin)].arity;
+  std::shared_ptr<AstBranch> arg = branch(ast->get(1));
+  if (n > 1 && arg &&
+      (arg->label() == Label::PairUp || arg->label() == Label::Tuple) &&
+      arg->count() == n) {
+    for (int k = 0; k < n; k++)
+      args.push_back(eval(env, arg->get(k)));
+    return;
+  }
+  std::shared_ptr<SMLValue> v = eval(env, ast->get(1));
+  if (n == 1)
+    args.push_back(v);
+  else if (n == 2 && v->type() == "PairUp") {
+    std::shared_ptr<SMLPair> p = std::static_pointer_cast<SMLPair>(v);
+    args = {p->first(), p->last()};
+  }
+  else if (v->type() == "Tuple" &&
+           std::static_pointer_cast<SMLTuple>(v)->size() == n) {
+    for (int k = 0; k < n; k++)
+      args.push_back(std::static_pointer_cast<SMLTuple>(v)->at(k));
+  }
+  else
+    throw expected(v);
+}
+
+RunTimeError BuiltinCall::expected(std::shared_ptr<SMLValue> v)
+{
+  const Signature &s = SIGNATURES[static_cast<int>(builtin)];
+  return RunTimeError(std::string(s.name) + " expects " + s.what + ", got " +
+                      v->to_string_typed() + " at " + ast->where() + ".");
+}
+
+RunTimeError BuiltinCall::error(std::string what)
+{
+  return RunTimeError(builtinName(builtin) + ": " + what + " at " +
+                      ast->where() + ".");
+}
+
+int BuiltinCall::integer(int k)
+{
+  if (args[k]->type() != "Int") throw expected(args[k]);
+  return *std::static_pointer_cast<SMLInt>(args[k]);
+}
+
+std::shared_ptr<SMLVector> BuiltinCall::vec(int k)
+{
+  if (args[k]->type() != "Vector") throw expected(args[k]);
+  return std::static_pointer_cast<SMLVector>(args[k]);
+}
+
+std::shared_ptr<SMLString> BuiltinCall::text(int k)
+{
+  if (args[k]->type() != "String") throw expected(args[k]);
+  return std::static_pointer_cast<SMLString>(args[k]);
+}
+
+std::shared_ptr<SMLClos> BuiltinCall::fn(int k)
+{
+  if (args[k]->type() != "Clos") throw expected(args[k]);
+  return std::static_pointer_cast<SMLClos>(args[k]);
+}
+
+std::shared_ptr<SMLValue> callBuiltin(Environment &env,
+                                      std::shared_ptr<AstBranch> ast)
+{
+  BuiltinCall call(env, ast);
+  if (call.builtin < Builtin::Size) return vectorBuiltin(call);
+  return textBuiltin(call);
+}
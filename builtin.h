@@ -0,0 +1,59 @@
+#pragma once
+#include "eval.h"
+
+struct SimdOptions {
+  bool enabled{true}; // use AVX2 kernels where the CPU has them
+};
+
+extern SimdOptions SIMD;
+
+// useAvx2: whether the kernels of vector.cc and text.cc may use AVX2
+bool useAvx2(void);
+
+// Builtin: the operations written as qualified names, such as
+// `Vector.map (f, v)` or `String.size s`. Their argument is one value, or a
+// pair or tuple of them.
+enum class Builtin {
+  Length,
+  Sub,
+  Tabulate,
+  Map,
+  Foldl,
+  Filter,
+  Size,
+  CharAt,
+  Substring,
+  IsSubstring,
+  Str,
+  Count
+};
+
+// builtinNamed: the builtin a qualified name such as "Vector.map" stands
+// for, or Builtin::Count if none
+Builtin builtinNamed(std::string name);
+std::string builtinName(Builtin b);
+
+// callBuiltin: Evaluates a Prim node's argument and applies the builtin
+std::shared_ptr<SMLValue> callBuiltin(Environment &env,
+                                      std::shared_ptr<AstBranch> ast);
+
+// BuiltinCall: a builtin applied to its evaluated arguments. The checks
+// report a wrong argument the same way for every builtin.
+class BuiltinCall {
+    public:
+  BuiltinCall(Environment &env, std::shared_ptr<AstBranch> ast);
+
+  Builtin builtin;
+  std::shared_ptr<AstBranch> ast;
+  std::vector<std::shared_ptr<SMLValue>> args;
+
+  RunTimeError expected(std::shared_ptr<SMLValue> v);
+  RunTimeError error(std::string what); // "<name>: <what> at <where>."
+  int integer(int k);
+  std::shared_ptr<SMLVector> vec(int k);
+  std::shared_ptr<SMLString> text(int k);
+  std::shared_ptr<SMLClos> fn(int k);
+};
+
+std::shared_ptr<SMLValue> vectorBuiltin(BuiltinCall &call); // vector.cc
+std::shared_ptr<SMLValue> textBuiltin(BuiltinCall &call);   // text.cc
@@ -0,0 +1,28 @@
+# emitcpp.cmake: checks that a corpus program compiled with --emit-cpp
+# prints what the interpreter does, its .out file. Run by CTest as
+#
+#   cmake -DMINIML=<MiniML> -DSOURCE=<source dir> -DCXX=<compiler>
+#         -DPROGRAM=<name.sml> -DWORK=<dir> -P emitcpp.cmake
+#
+# from the corpus directory, so positions name the file as the .out does.
+get_filename_component(stem ${PROGRAM} NAME_WE)
+set(cpp ${WORK}/${stem}.cc)
+set(exe ${WORK}/${stem})
+file(MAKE_DIRECTORY ${WORK})
+
+execute_process(COMMAND ${MINIML} --no-cache --emit-cpp ${PROGRAM}
+                OUTPUT_FILE ${cpp} RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM}: --emit-cpp failed")
+endif()
+execute_process(COMMAND ${CXX} -std=c++17 -I ${SOURCE} ${cpp} -o ${exe}
+                RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM}: the emitted C++ does not build:\n${errors}")
+endif()
+execute_process(COMMAND ${exe} OUTPUT_VARIABLE got RESULT_VARIABLE status)
+file(READ ${stem}.out expected)
+if(NOT status EQUAL 0 OR NOT got STREQUAL expected)
+    message(FATAL_ERROR "${PROGRAM}: exit ${status}\nexpected:\n${expected}"
+                        "got:\n${got}")
+endif()
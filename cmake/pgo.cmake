@@ -0,0 +1,138 @@
+# pgo.cmake: the profile-guided build, run by the MiniML-pgo target as
+#
+#   cmake -DSOURCE=<source dir> -DBINARY=<work dir> [-DCXX=<compiler>]
+#         [-DREPS=<best of>] -P pgo.cmake
+#
+# 1. builds an instrumented MiniML in BINARY/generate,
+# 2. trains it on the unit tests, the tests corpus and bench/train,
+# 3. rebuilds it with that profile and link-time optimization in BINARY/use,
+# 4. builds a plain -O2 MiniML in BINARY/o2 and times both on bench/eval.
+if(NOT SOURCE OR NOT BINARY)
+    message(FATAL_ERROR "usage: cmake -DSOURCE=dir -DBINARY=dir -P pgo.cmake")
+endif()
+if(NOT REPS)
+    set(REPS 3)
+endif()
+set(profile ${BINARY}/profile)
+set(compiler)
+if(CXX)
+    set(compiler -DCMAKE_CXX_COMPILER=${CXX})
+endif()
+
+function(run what)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE status
+                    OUTPUT_VARIABLE out ERROR_VARIABLE out)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "MiniML-pgo: ${what} failed:\n${out}")
+    endif()
+endfunction()
+
+# build: configures and builds MiniML in BINARY/<dir> with some options
+function(build dir)
+    message(STATUS "MiniML-pgo: building ${dir}")
+    run("configuring ${dir}" ${CMAKE_COMMAND} -S ${SOURCE} -B ${BINARY}/${dir}
+        -DCMAKE_BUILD_TYPE=Release ${compiler} ${ARGN})
+    run("building ${dir}" ${CMAKE_COMMAND} --build ${BINARY}/${dir}
+        --target MiniML)
+endfunction()
+
+file(REMOVE_RECURSE ${profile})
+build(generate -DMINIML_PGO=generate -DMINIML_PGO_DIR=${profile}
+      -DMINIML_LTO=OFF)
+
+# training: --no-cache, so every run lexes and parses as well
+message(STATUS "MiniML-pgo: training")
+set(trainer ${BINARY}/generate/MiniML)
+run("the unit tests" ${trainer} test WORKING_DIRECTORY ${SOURCE})
+run("the tests corpus" ${trainer} test tests WORKING_DIRECTORY ${SOURCE})
+file(GLOB training ${SOURCE}/bench/train/*.sml)
+foreach(program ${training})
+    run(${program} ${trainer} --no-cache ${program} WORKING_DIRECTORY ${SOURCE})
+endforeach()
+
+file(GLOB raw ${profile}/*.profraw)
+if(raw)
+    find_program(PROFDATA NAMES llvm-profdata)
+    if(NOT PROFDATA)
+        message(FATAL_ERROR "MiniML-pgo: llvm-profdata is needed to merge ${profile}")
+    endif()
+    run("merging the profile" ${PROFDATA} merge -o ${profile}/miniml.profdata
+        ${raw})
+endif()
+
+build(use -DMINIML_PGO=use -DMINIML_PGO_DIR=${profile} -DMINIML_LTO=ON)
+build(o2 -DMINIML_PGO= -DMINIML_LTO=OFF "-DCMAKE_CXX_FLAGS_RELEASE=-O2 -DNDEBUG")
+
+# timing: best of REPS runs of each program, by wall clock
+if(${CMAKE_VERSION} VERSION_LESS 3.23)
+    message(STATUS "MiniML-pgo: built ${BINARY}/use/MiniML; timing needs CMake 3.23")
+    return()
+endif()
+
+function(best binary program result)
+    set(least)
+    foreach(rep RANGE 1 ${REPS})
+        string(TIMESTAMP t0 "%s%f")
+        run(${program} ${binary} --no-cache ${program}
+            WORKING_DIRECTORY ${SOURCE})
+        string(TIMESTAMP t1 "%s%f")
+        math(EXPR us "${t1} - ${t0}")
+        if(NOT least OR us LESS least)
+            set(least ${us})
+        endif()
+    endforeach()
+    set(${result} ${least} PARENT_SCOPE)
+endfunction()
+
+# ratio: a / b to two decimals
+function(ratio a b result)
+    math(EXPR hundredths "(${a} * 100 + ${b} / 2) / ${b}")
+    math(EXPR whole "${hundredths} / 100")
+    math(EXPR part "${hundredths} % 100")
+    if(part LESS 10)
+        set(part 0${part})
+    endif()
+    set(${result} ${whole}.${part} PARENT_SCOPE)
+endfunction()
+
+# column: text padded on the left or right to a width
+function(column text width side result)
+    string(LENGTH "${text}" n)
+    while(n LESS width)
+        if(side STREQUAL "left")
+            set(text " ${text}")
+        else()
+            set(text "${text} ")
+        endif()
+        math(EXPR n "${n} + 1")
+    endwhile()
+    set(${result} "${text}" PARENT_SCOPE)
+endfunction()
+
+# row: one line of the report, times in microseconds
+function(row name o2 pgo)
+    ratio(${o2} ${pgo} speedup)
+    math(EXPR o2 "${o2} / 1000")
+    math(EXPR pgo "${pgo} / 1000")
+    column("${name}" 16 right name)
+    column("${o2}" 8 left o2)
+    column("${pgo}" 12 left pgo)
+    column("${speedup}x" 9 left speedup)
+    message("  ${name}${o2}${pgo}${speedup}")
+endfunction()
+
+message(STATUS "MiniML-pgo: timing bench/eval, best of ${REPS}")
+message("  program           -O2 ms  PGO+LTO ms  speedup")
+set(total_o2 0)
+set(total_pgo 0)
+file(GLOB programs ${SOURCE}/bench/eval/*.sml)
+foreach(program ${programs})
+    best(${BINARY}/o2/MiniML ${program} o2)
+    best(${BINARY}/use/MiniML ${program} pgo)
+    math(EXPR total_o2 "${total_o2} + ${o2}")
+    math(EXPR total_pgo "${total_pgo} + ${pgo}")
+    get_filename_component(name ${program} NAME)
+    row(${name} ${o2} ${pgo})
+endforeach()
+row(total ${total_o2} ${total_pgo})
+message(STATUS "MiniML-pgo: built ${BINARY}/use/MiniML")
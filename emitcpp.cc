@@ -0,0 +1,275 @@
+#include "emitcpp.h"
+
+// CppEmitter::operator(): Emits a complete program. Top-level declarations
+// become locals of main's body and each top-level expression is shown as it
+// is reached.
+//
+// std::shared_ptr<AstNode> program: the parsed program
+//
+// return std::string: C++ source with a main that prints like MiniML does
+
+std::string CppEmitter::operator()(std::shared_ptr<AstNode> program)
+{
+  scope.clear();
+  fresh = 0;
+  std::string body;
+  std::shared_ptr<AstBranch> items =
+      std::dynamic_pointer_cast<AstBranch>(program);
+  if (items && items->label() == Label::Program) {
+    for (int k = 0; k < items->count(); k++) {
+      std::shared_ptr<AstBranch> item =
+          std::dynamic_pointer_cast<AstBranch>(items->get(k));
+      if (item->label() == Label::Val || item->label() == Label::Fun ||
+          item->label() == Label::Funs)
+        body += "    " + decl(item) + "\n";
+      else
+        body += "    smlrt::show(" + expn(item) + ");\n";
+    }
+  }
+  else
+    body = "    smlrt::show(" + expn(program) + ");\n";
+  return "// Generated by MiniML --emit-cpp from " + source_name +
+         "\n"
+         "#include \"smlrt.h\"\n"
+         "\n"
+         "int main(void)\n"
+         "{\n"
+         "  return smlrt::run([&]() {\n" +
+         body +
+         "  });\n"
+         "}\n";
+}
+
+std::string CppEmitter::name(std::shared_ptr<AstNode> node)
+{
+  return std::dynamic_pointer_cast<AstString>(node)->get_string();
+}
+
+// CppEmitter::quote: Turns s into a C++ string literal
+//
+// std::string s: raw text
+//
+// return std::string: the literal, quotes included
+
+std::string CppEmitter::quote(std::string s)
+{
+  std::string out{"\""};
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += std::string("\\") + c;
+    else if (c == '\n')
+      out += "\\n";
+    else if (c == '\t')
+      out += "\\t";
+    else
+      out += c;
+  }
+  return out + "\"";
+}
+
+// CppEmitter::bind: Brings an SML name into scope under a fresh C++ name
+//
+// std::string name: the SML name
+//
+// return std::string: the C++ variable
+
+std::string CppEmitter::bind(std::string name)
+{
+  std::string var = "v_" + name + "_" + std::to_string(fresh++);
+  scope.push_back({name, var});
+  return var;
+}
+
+// CppEmitter::resolve: The C++ variable an SML name refers to. The search
+// runs from the innermost binding, as Environment::lookup does.
+//
+// std::string name: the SML name
+//
+// return std::string: a C++ expression for the variable
+
+std::string CppEmitter::resolve(std::string name)
+{
+  for (int i = scope.size() - 1; i >= 0; i--)
+    if (scope.at(i).first == name) return scope.at(i).second;
+  return "smlrt::unbound(" + quote(name) + ")";
+}
+
+// CppEmitter::decl: Emits the statements for a declaration and leaves its
+// names in scope. A `fun ... and ...` group creates all of its closures
+// before defining any, so every body can capture all of them.
+//
+// std::shared_ptr<AstBranch> d: a Val, Fun or Funs node
+//
+// return std::string: C++ statements
+
+std::string CppEmitter::decl(std::shared_ptr<AstBranch> d)
+{
+  if (d->label() == Label::Val) {
+    std::string r = expn(d->get(1));
+    return "smlrt::Value " + bind(name(d->get(0))) + " = " + r + "; ";
+  }
+  std::vector<std::shared_ptr<AstBranch>> group;
+  if (d->label() != Label::Funs)
+    group.push_back(d);
+  else
+    for (int i = 0; i < d->count(); i++)
+      group.push_back(std::static_pointer_cast<AstBranch>(d->get(i)));
+
+  std::string out;
+  std::vector<std::string> vars;
+  for (auto fun : group) {
+    std::string text = "[" + name(fun->get(1)) + " => " +
+                       fun->get(2)->to_string() + "]";
+    vars.push_back(bind(name(fun->get(0))));
+    out += "smlrt::Value " + vars.back() + " = smlrt::closure(" +
+           quote(text) + "); ";
+  }
+  for (int i = 0; i < group.size(); i++) {
+    std::string x = bind(name(group[i]->get(1)));
+    out += "smlrt::define(" + vars[i] + ", [=](smlrt::Value " + x +
+           ") -> smlrt::Value { return " + expn(group[i]->get(2)) + "; }); ";
+    scope.pop_back();
+  }
+  return out;
+}
+
+// CppEmitter::expn: Lowers one expression
+//
+// std::shared_ptr<AstNode> node: the expression
+//
+// return std::string: a C++ expression of type smlrt::Value
+
+std::string CppEmitter::expn(std::shared_ptr<AstNode> node)
+{
+  if (node->is_leaf()) {
+    std::shared_ptr<AstLeaf> leaf = std::dynamic_pointer_cast<AstLeaf>(node);
+    if (leaf->label() == Label::Int)
+      return "smlrt::Int(" + std::to_string(leaf->val()) + ")";
+    else if (leaf->label() == Label::Bool)
+      return leaf->val() ? "smlrt::Bool(true)" : "smlrt::Bool(false)";
+    else if (leaf->label() == Label::Unit)
+      return "smlrt::Unit()";
+    else
+      throw NotImplemented("C++ emission of literal " + leaf->string_label());
+  }
+  if (node->is_string())
+    return "smlrt::text(" +
+           quote(std::static_pointer_cast<AstString>(node)->get_string()) +
+           ")";
+  if (!node->is_branch())
+    throw NotImplemented("C++ emission of " + node->to_string());
+
+  std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(node);
+  std::string where = ast->where();
+  switch (ast->label()) {
+  case Label::Literal:
+    return expn(ast->get(0));
+  case Label::If:
+    return "(smlrt::truthy(" + expn(ast->get(0)) + ") ? " + expn(ast->get(1)) +
+           " : " + expn(ast->get(2)) + ")";
+  case Label::Let: {
+    int outer = scope.size();
+    std::string d = decl(std::dynamic_pointer_cast<AstBranch>(ast->get(0)));
+    std::string b = expn(ast->get(1));
+    scope.resize(outer);
+    return "[&]() -> smlrt::Value { " + d + "return " + b + "; }()";
+  }
+  case Label::Lam: {
+    std::string text = "[" + name(ast->get(0)) + " => " +
+                       ast->get(1)->to_string() + "]";
+    std::string x = bind(name(ast->get(0)));
+    std::string b = expn(ast->get(1));
+    scope.pop_back();
+    return "smlrt::lambda(" + quote(text) + ", [=](smlrt::Value " + x +
+           ") -> smlrt::Value { return " + b + "; })";
+  }
+  case Label::App:
+    return "smlrt::apply(smlrt::Call{smlrt::callee(" + expn(ast->get(0)) +
+           "), " + expn(ast->get(1)) + "})";
+  case Label::Var:
+    return resolve(name(ast->get(0)));
+  case Label::Or:
+    return "(smlrt::truthy(" + expn(ast->get(0)) +
+           ") ? smlrt::Bool(true) : smlrt::boolean(" + expn(ast->get(1)) +
+           "))";
+  case Label::And:
+    return "(!smlrt::truthy(" + expn(ast->get(0)) +
+           ") ? smlrt::Bool(false) : smlrt::boolean(" + expn(ast->get(1)) +
+           "))";
+  case Label::Plus:
+  case Label::Minus:
+  case Label::Times:
+  case Label::Div:
+  case Label::Mod: {
+    std::string op = ast->label() == Label::Plus    ? "plus"
+                     : ast->label() == Label::Minus ? "minus"
+                     : ast->label() == Label::Times ? "times"
+                     : ast->label() == Label::Div   ? "div"
+                                                    : "mod";
+    // division reports where it divided by zero
+    bool divides = ast->label() == Label::Div || ast->label() == Label::Mod;
+    return "smlrt::" + op + "(smlrt::Ints{smlrt::arith1(" + expn(ast->get(0)) +
+           "), smlrt::arith2(" + expn(ast->get(1)) + ")}" +
+           (divides ? ", " + quote(where) : "") + ")";
+  }
+  case Label::Less:
+    return "smlrt::less(smlrt::Ints{smlrt::cmp1(" + expn(ast->get(0)) +
+           "), smlrt::cmp2(" + expn(ast->get(1)) + ")})";
+  case Label::Equals:
+    return "smlrt::equal(smlrt::Two{smlrt::eq1(" + expn(ast->get(0)) + "), " +
+           expn(ast->get(1)) + "})";
+  case Label::Concat:
+    return "smlrt::join(smlrt::Two{smlrt::join1(" + expn(ast->get(0)) + ", " +
+           quote(where) + "), " + expn(ast->get(1)) + "}, " + quote(where) +
+           ")";
+  case Label::PairUp:
+    return "smlrt::pair(smlrt::Two{" + expn(ast->get(0)) + ", " +
+           expn(ast->get(1)) + "})";
+  case Label::Tuple: {
+    std::string fields;
+    for (int k = 0; k < ast->count(); k++)
+      fields += (k ? ", " : "") + expn(ast->get(k));
+    return "smlrt::tuple({" + fields + "})";
+  }
+  case Label::Vec: {
+    std::string ints;
+    for (int k = 0; k < ast->count(); k++)
+      ints += (k ? ", " : "") + std::string("smlrt::element(") +
+              expn(ast->get(k)) + ", " + quote(where) + ")";
+    return "smlrt::vector({" + ints + "})";
+  }
+  case Label::Prim:
+    return "smlrt::builtin(" +
+           std::to_string(
+               std::static_pointer_cast<AstLeaf>(ast->get(0))->val()) +
+           ", " + expn(ast->get(1)) + ", " + quote(where) + ")";
+  case Label::Select:
+    return "smlrt::select(" + expn(ast->get(0)) + ", " +
+           std::to_string(
+               std::static_pointer_cast<AstLeaf>(ast->get(1))->val()) +
+           ", " + quote(where) + ")";
+  case Label::First:
+    return "smlrt::first(" + expn(ast->get(0)) + ", " +
+           quote("Attempted to extract 1st component of a non-pair at " +
+                 where + ".") +
+           ")";
+  case Label::Second:
+    return "smlrt::second(" + expn(ast->get(0)) + ", " +
+           quote("Attempted to extract 2nd component of a non-pair at " +
+                 where + ".") +
+           ")";
+  case Label::Seq: {
+    std::string out = "(";
+    for (int i = 0; i + 1 < ast->count(); i++)
+      out += "(void)" + expn(ast->get(i)) + ", ";
+    return out + expn(ast->get(ast->count() - 1)) + ")";
+  }
+  case Label::Print:
+    return "smlrt::print(" + expn(ast->get(0)) + ")";
+  case Label::Not:
+    return "smlrt::Bool(!smlrt::truthy(" + expn(ast->get(0)) + "))";
+  default:
+    throw NotImplemented("C++ emission of AST: \"" + ast->string_label() +
+                         "\"");
+  }
+}
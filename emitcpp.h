@@ -0,0 +1,22 @@
+#pragma once
+#include "parser.h"
+
+// CppEmitter: lowers a parsed program to a C++ translation unit built on
+// smlrt.h. Every binder gets its own C++ variable, so scoping is settled at
+// compile time; closures become lambdas that capture by value.
+class CppEmitter {
+    public:
+  CppEmitter(std::string sourcename) { source_name = sourcename; }
+  std::string operator()(std::shared_ptr<AstNode> program);
+
+    private:
+  std::string expn(std::shared_ptr<AstNode> node);
+  std::string decl(std::shared_ptr<AstBranch> d);
+  std::string bind(std::string name);
+  std::string resolve(std::string name);
+  static std::string name(std::shared_ptr<AstNode> node);
+  static std::string quote(std::string s);
+  std::string source_name;
+  std::vector<std::pair<std::string, std::string>> scope; // SML, C++ names
+  int fresh{0};
+};
@@ -0,0 +1,272 @@
+#include "escape.h"
+#include <algorithm>
+
+static std::shared_ptr<AstBranch> branch(std::shared_ptr<AstNode> n)
+{
+  return n->is_branch() ? std::static_pointer_cast<AstBranch>(n) : nullptr;
+}
+
+static std::string text(std::shared_ptr<AstNode> n)
+{
+  return std::static_pointer_cast<AstString>(n)->get_string();
+}
+
+static bool isVar(std::shared_ptr<AstNode> n, std::string const &x)
+{
+  return n->is_branch() && n->label() == Label::Var &&
+         text(branch(n)->get(0)) == x;
+}
+
+static std::shared_ptr<AstBranch>
+make(Label l, std::string where, std::vector<std::shared_ptr<AstNode>> args)
+{
+  std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
+  out->label(l);
+  for (std::shared_ptr<AstNode> &a : args)
+    out->add(a);
+  out->where(where);
+  return out;
+}
+
+static std::shared_ptr<AstBranch> var(std::string x, std::string where)
+{
+  return make(Label::Var, where, {AstString::New(x)});
+}
+
+// bound: the names a Val, Fun or Funs node declares
+static std::vector<std::string> bound(std::shared_ptr<AstBranch> d)
+{
+  if (d->label() != Label::Funs) return {text(d->get(0))};
+  std::vector<std::string> out;
+  for (int i = 0; i < d->count(); i++)
+    out.push_back(text(branch(d->get(i))->get(0)));
+  return out;
+}
+
+// Use: a projection of the variable being looked for, at parent->get(i)
+struct Use {
+  std::shared_ptr<AstBranch> parent;
+  int i;
+};
+
+// uses: Finds every use of x in the child i of parent, where x is free.
+// With `calls`, a use is `fst (x e)` or `snd (x e)`, otherwise `fst x` or
+// `snd x`.
+//
+// return bool: false if x is used any other way
+static bool uses(std::shared_ptr<AstBranch> parent, int i, std::string const &x,
+                 bool calls, std::vector<Use> &out)
+{
+  std::shared_ptr<AstBranch> ast = branch(parent->get(i));
+  if (!ast) return true;
+  Label l = ast->label();
+  if (l == Label::Var) return text(ast->get(0)) != x;
+  if (l == Label::First || l == Label::Second) {
+    std::shared_ptr<AstBranch> e = branch(ast->get(0));
+    if (!calls && isVar(e, x)) {
+      out.push_back({parent, i});
+      return true;
+    }
+    if (calls && e && e->label() == Label::App && isVar(e->get(0), x)) {
+      out.push_back({parent, i});
+      return uses(e, 1, x, calls, out);
+    }
+  }
+  // names bound in here hide x
+  if (l == Label::Lam && text(ast->get(0)) == x) return true;
+  if (l == Label::Fun && (text(ast->get(0)) == x || text(ast->get(1)) == x))
+    return true;
+  if (l == Label::Funs) {
+    std::vector<std::string> names = bound(ast);
+    if (std::find(names.begin(), names.end(), x) != names.end()) return true;
+  }
+  if (l == Label::Let) {
+    if (!uses(ast, 0, x, calls, out)) return false;
+    std::vector<std::string> names = bound(branch(ast->get(0)));
+    if (std::find(names.begin(), names.end(), x) != names.end()) return true;
+    return uses(ast, 1, x, calls, out);
+  }
+  for (int j = 0; j < ast->count(); j++)
+    if (!uses(ast, j, x, calls, out)) return false;
+  return true;
+}
+
+// captures: Marks the subtree with whether it makes any closure
+static bool captures(std::shared_ptr<AstNode> node)
+{
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast) return false;
+  bool c = ast->label() == Label::Lam || ast->label() == Label::Fun ||
+           ast->label() == Label::Funs;
+  for (int i = 0; i < ast->count(); i++)
+    c = captures(ast->get(i)) || c;
+  ast->captures(c);
+  return c;
+}
+
+// Escapes: one run of the rewrites, with the names in scope at each node
+class Escapes {
+    public:
+  std::shared_ptr<AstNode> rewrite(std::shared_ptr<AstNode> node);
+
+    private:
+  bool pure(std::shared_ptr<AstNode> n);
+  std::shared_ptr<AstNode> project(std::shared_ptr<AstNode> n, Label k);
+  void scalarize(std::shared_ptr<AstBranch> let);
+  void projectCalls(std::shared_ptr<AstBranch> let);
+  std::string fresh(std::string x) { return x + "." + std::to_string(++n); }
+
+  std::vector<std::string> scope; // innermost last
+  int n{0};
+};
+
+// Escapes::pure: whether evaluating n can't fail, loop or print, so it may be
+// moved or dropped
+bool Escapes::pure(std::shared_ptr<AstNode> n)
+{
+  if (!n->is_branch()) return true;
+  if (n->label() == Label::Literal || n->label() == Label::Lam) return true;
+  if (n->label() == Label::Var)
+    return std::find(scope.begin(), scope.end(),
+                     text(branch(n)->get(0))) != scope.end();
+  return false;
+}
+
+// Escapes::project: An expression for the component k (First or Second) of
+// the pair n evaluates to, that doesn't build the pair
+//
+// return std::shared_ptr<AstNode>: null unless every pair n can return is
+// built in plain sight
+std::shared_ptr<AstNode> Escapes::project(std::shared_ptr<AstNode> n, Label k)
+{
+  std::shared_ptr<AstBranch> ast = branch(n);
+  if (!ast) return nullptr;
+  std::string where = ast->where();
+  if (ast->label() == Label::PairUp) {
+    std::shared_ptr<AstNode> a = ast->get(0), b = ast->get(1);
+    if (k == Label::Second)
+      return pure(a) ? b : make(Label::Seq, where, {a, b});
+    if (pure(b)) return a;
+    // b still runs, after a
+    std::string t = fresh("");
+    return make(Label::Let, where,
+                {make(Label::Val, where, {AstString::New(t), a}),
+                 make(Label::Seq, where, {b, var(t, where)})});
+  }
+  if (ast->label() == Label::If) {
+    std::shared_ptr<AstNode> t = project(ast->get(1), k);
+    std::shared_ptr<AstNode> e = t ? project(ast->get(2), k) : nullptr;
+    if (!e) return nullptr;
+    return make(Label::If, where, {ast->get(0), t, e});
+  }
+  if (ast->label() == Label::Seq) {
+    int n = ast->count();
+    std::shared_ptr<AstNode> last = project(ast->get(n - 1), k);
+    if (!last) return nullptr;
+    std::vector<std::shared_ptr<AstNode>> items;
+    for (int i = 0; i < n - 1; i++)
+      items.push_back(ast->get(i));
+    items.push_back(last);
+    return make(Label::Seq, where, items);
+  }
+  if (ast->label() == Label::Let) {
+    std::vector<std::string> names = bound(branch(ast->get(0)));
+    scope.insert(scope.end(), names.begin(), names.end());
+    std::shared_ptr<AstNode> body = project(ast->get(1), k);
+    scope.resize(scope.size() - names.size());
+    if (!body) return nullptr;
+    return make(Label::Let, where, {ast->get(0), body});
+  }
+  return nullptr;
+}
+
+// Escapes::scalarize: let val p = (a, b) in ... fst p ... snd p ... end
+// becomes let val p.1 = a in let val p.2 = b in ... p.1 ... p.2 ... end end
+void Escapes::scalarize(std::shared_ptr<AstBranch> let)
+{
+  std::shared_ptr<AstBranch> val = branch(let->get(0));
+  std::shared_ptr<AstBranch> pair = branch(val->get(1));
+  std::string p = text(val->get(0));
+  std::vector<Use> found;
+  if (!uses(let, 1, p, false, found)) return;
+  // fresh names, so no binding in between can hide them
+  std::string first = fresh(p), second = fresh(p);
+  for (Use &u : found) {
+    std::shared_ptr<AstBranch> use = branch(u.parent->get(u.i));
+    u.parent->set(u.i, var(use->label() == Label::First ? first : second,
+                           use->where()));
+  }
+  std::string where = let->where();
+  std::shared_ptr<AstNode> body = let->get(1);
+  let->set(0, make(Label::Val, where, {AstString::New(first), pair->get(0)}));
+  let->set(1, make(Label::Let, where,
+                   {make(Label::Val, where,
+                         {AstString::New(second), pair->get(1)}),
+                    body}));
+}
+
+// Escapes::projectCalls: let val f = fn x => B in ... fst (f e) ... end
+// becomes let val f = fn x => fst B in ... f e ... end, with the projection
+// worked into B
+void Escapes::projectCalls(std::shared_ptr<AstBranch> let)
+{
+  std::shared_ptr<AstBranch> val = branch(let->get(0));
+  std::shared_ptr<AstBranch> lam = branch(val->get(1));
+  std::vector<Use> found;
+  if (!uses(let, 1, text(val->get(0)), true, found) || found.empty()) return;
+  Label k = found[0].parent->get(found[0].i)->label();
+  for (Use &u : found)
+    if (u.parent->get(u.i)->label() != k) return;
+  scope.push_back(text(lam->get(0)));
+  std::shared_ptr<AstNode> body = project(lam->get(1), k);
+  scope.pop_back();
+  if (!body) return;
+  lam->set(1, body);
+  for (Use &u : found)
+    u.parent->set(u.i, branch(u.parent->get(u.i))->get(0));
+}
+
+// Escapes::rewrite: Rewrites the subtree bottom up
+//
+// return std::shared_ptr<AstNode>: what replaces it
+std::shared_ptr<AstNode> Escapes::rewrite(std::shared_ptr<AstNode> node)
+{
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast) return node;
+  Label l = ast->label();
+
+  std::vector<std::string> names;
+  if (l == Label::Lam) names = {text(ast->get(0))};
+  if (l == Label::Fun) names = {text(ast->get(0)), text(ast->get(1))};
+  if (l == Label::Funs) names = bound(ast);
+  scope.insert(scope.end(), names.begin(), names.end());
+  for (int i = 0; i < ast->count(); i++) {
+    if (l == Label::Let && i == 1) {
+      names = bound(branch(ast->get(0)));
+      scope.insert(scope.end(), names.begin(), names.end());
+    }
+    ast->set(i, rewrite(ast->get(i)));
+  }
+  scope.resize(scope.size() - names.size());
+
+  if (l == Label::First || l == Label::Second) {
+    std::shared_ptr<AstBranch> e = branch(ast->get(0));
+    if (e && e->label() == Label::PairUp) return project(e, l);
+  }
+  if (l == Label::Let) {
+    std::shared_ptr<AstBranch> d = branch(ast->get(0));
+    std::shared_ptr<AstBranch> r =
+        d->label() == Label::Val ? branch(d->get(1)) : nullptr;
+    if (r && r->label() == Label::PairUp) scalarize(ast);
+    if (r && r->label() == Label::Lam) projectCalls(ast);
+  }
+  return ast;
+}
+
+std::shared_ptr<AstNode> analyzeEscapes(std::shared_ptr<AstNode> program)
+{
+  Escapes pass;
+  program = pass.rewrite(program);
+  captures(program);
+  return program;
+}
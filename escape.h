@@ -0,0 +1,18 @@
+#pragma once
+#include "parser.h"
+
+// analyzeEscapes: Rewrites a program so that values which never leave the
+// scope that makes them are not allocated at all:
+//  - `fst (a, b)` and `snd (a, b)` evaluate both components but keep one,
+//    without building the pair;
+//  - `let val p = (a, b) in ... end`, where p is only ever projected, binds
+//    the two components instead of the pair;
+//  - `let val f = fn x => ... in ... end`, where every use of f is the same
+//    projection of a call and every result of the body is a visible pair,
+//    makes f return that component.
+// It also marks every subtree that makes no closure with captures(false).
+// Nothing can keep hold of an environment such a subtree is evaluated in,
+// so the frame of a `let val` or a call around it lives on the stack.
+//
+// return std::shared_ptr<AstNode>: the root, which may have been replaced
+std::shared_ptr<AstNode> analyzeEscapes(std::shared_ptr<AstNode> program);
@@ -1,14 +1,138 @@
 #include "eval.h"
+#include "builtin.h"
+#include "jit.h"
+#include "parallel.h"
+#include "text.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <pthread.h>
+#include <sstream>
+#include <utility>
 
-std::vector<std::string> INTOPS = {"Plus", "Minus", "Times", "Div", "Mod"};
-std::vector<std::string> CMPOPS = {"Equals", "Less"};
+static EvalContext default_context;
+static thread_local EvalContext *current_context = nullptr;
+static thread_local int tick = EVAL_POLL_INTERVAL;  // steps until next poll
+static thread_local int armed = EVAL_POLL_INTERVAL; // what tick was set to
+// eval stops short of this, the end of the thread's stack less a margin for
+// the frames between two evals; null until the thread starts an evaluation
+static thread_local char *stack_floor = nullptr;
+const size_t STACK_MARGIN = 256 * 1024;
+
+Limits LIMITS;
+
+EvalContext &context(void)
+{
+  return current_context ? *current_context : default_context;
+}
+
+ContextScope::ContextScope(EvalContext *ctx)
+{
+  saved = current_context;
+  current_context = ctx;
+}
+
+ContextScope::~ContextScope() { current_context = saved; }
+
+std::string Usage::to_string(void)
+{
+  std::ostringstream out;
+  out << steps << " steps, " << bytes << " bytes, " << seconds << "s";
+  return out.str();
+}
+
+// findStackFloor: Where eval stops short of running off the stack
+static char *findStackFloor(void)
+{
+#ifdef __linux__
+  pthread_attr_t attr;
+  void *low;
+  size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr)) return nullptr;
+  int failed = pthread_attr_getstack(&attr, &low, &size);
+  pthread_attr_destroy(&attr);
+  if (failed || size <= 2 * STACK_MARGIN) return nullptr;
+  return static_cast<char *>(low) + STACK_MARGIN;
+#else
+  return nullptr;
+#endif
+}
+
+char *stackFloor(void)
+{
+  if (!stack_floor) stack_floor = findStackFloor();
+  return stack_floor;
+}
+
+void EvalContext::start(Limits l)
+{
+  stackFloor();
+  limits = l;
+  steps = 0;
+  base_bytes = threadBytes();
+  owner = std::this_thread::get_id();
+  seen_bytes = 0;
+  started = std::chrono::steady_clock::now();
+  armed = tick = limits.steps ? std::min<long>(EVAL_POLL_INTERVAL, limits.steps)
+                              : EVAL_POLL_INTERVAL;
+}
+
+Usage EvalContext::usage(void)
+{
+  long bytes = std::this_thread::get_id() == owner
+                   ? threadBytes() - base_bytes
+                   : seen_bytes.load(std::memory_order_relaxed);
+  return Usage{steps.load(std::memory_order_relaxed) + armed - tick, bytes,
+               std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             started)
+                   .count()};
+}
+
+void EvalContext::checkBytes(void)
+{
+  if (std::this_thread::get_id() != owner) return; // not this thread's bytes
+  long used = threadBytes() - base_bytes;
+  seen_bytes.store(used, std::memory_order_relaxed);
+  if (limits.bytes && used > limits.bytes)
+    throw LimitExceeded("Memory limit of " + std::to_string(limits.bytes) +
+                        " bytes exceeded (" + usage().to_string() + ")");
+}
+
+// EvalContext::poll: Called every EVAL_POLL_INTERVAL steps, or sooner when
+// fewer are left, to enforce the deadline and limits
+
+void EvalContext::poll(void)
+{
+  long used = steps.fetch_add(armed, std::memory_order_relaxed) + armed;
+  armed = tick = 0; // counted; usage sees none pending
+  if (parallelCancelled()) throw Cancelled();
+  auto now = std::chrono::steady_clock::now();
+  if (now > deadline)
+    throw Timeout("Evaluation timed out (" + usage().to_string() + ")");
+  if (limits.seconds > 0 &&
+      std::chrono::duration<double>(now - started).count() > limits.seconds) {
+    std::ostringstream msg;
+    msg << "Time limit of " << limits.seconds << "s exceeded ("
+        << usage().to_string() << ")";
+    throw Timeout(msg.str());
+  }
+  long next = EVAL_POLL_INTERVAL;
+  if (limits.steps) {
+    if (used >= limits.steps)
+      throw LimitExceeded("Step limit of " + std::to_string(limits.steps) +
+                          " exceeded (" + usage().to_string() + ")");
+    next = std::min(next, limits.steps - used);
+  }
+  checkBytes();
+  armed = tick = next;
+}
 
 std::shared_ptr<SMLValue> SMLValue::New(void)
 {
   return std::shared_ptr<SMLValue>(new SMLValue());
 }
 
-string SMLValue::type(void) { return tag; }
+string const &SMLValue::type(void) { return tag; }
 void SMLValue::setTag(string t) { tag = t; }
 string SMLValue::to_string(void) { return "(SMLValue)"; }
 string SMLValue::to_string_typed(void)
@@ -16,31 +140,84 @@ string SMLValue::to_string_typed(void)
   return "[" + tag + ", " + to_string() + "]";
 }
 
+void SMLValue::render(ValuePrinter &p)
+{
+  p.out.write(p.typed ? to_string_typed() : to_string());
+}
+
+void ValuePrinter::operator()(SMLValue *v)
+{
+  pending.push_back({v, {}});
+  while (pending.size()) {
+    Item item = pending.back();
+    pending.pop_back();
+    if (item.v)
+      item.v->render(*this);
+    else
+      out.write(item.s);
+  }
+}
+
+// printed: What a printer writes for v
+static string printed(SMLValue *v, bool typed)
+{
+  std::ostringstream text;
+  {
+    Output out(&text, 256);
+    ValuePrinter(out, typed)(v);
+  }
+  return text.str();
+}
+
+Frame::~Frame()
+{
+  // unlink frames nobody else holds one at a time, not recursively, so long
+  // environments don't overflow the stack
+  std::shared_ptr<Frame> next = std::move(parent);
+  while (next && next.use_count() == 1)
+    next = std::move(next->parent);
+}
+
 Environment Environment::add(string name, std::shared_ptr<SMLValue> v)
 {
-  Binding tmp{name, v};
-  Environment out = Environment(*this);
-  out.hold.push_back(tmp);
+  Environment out;
+  out.top = std::allocate_shared<Frame>(SlabAllocator<Frame>(SlabKind::Frame),
+                                        Binding{name, v}, top);
+  return out;
+}
+
+Environment Environment::push(Frame &frame, string name,
+                              std::shared_ptr<SMLValue> v)
+{
+  frame.binding = {name, v};
+  frame.parent = top;
+  Environment out;
+  // shares no ownership: the frame goes when the caller's scope does
+  out.top = std::shared_ptr<Frame>(std::shared_ptr<Frame>(), &frame);
   return out;
 }
 
-std::shared_ptr<SMLValue> Environment::lookup(string x, string err)
+std::shared_ptr<SMLValue> Environment::lookup(string x)
 {
-  for (int i = 0; i < hold.size(); i++)
-    if (hold.at(i).name == x) return hold.at(i).value;
-  string current_vars{""};
-  for (int i = 0; i < hold.size(); i++)
-    current_vars += hold.at(i).name + "\n";
+  for (Frame *f = top.get(); f; f = f->parent.get()) // newest binding shadows
+    if (f->binding.name == x) return f->binding.value;
   throw RunTimeError("Use of variable '" + x + "'. " + "\n" +
                      this->to_string());
 }
 
-Environment::Environment(const Environment &t) { hold = t.hold; }
+vector<Binding *> Environment::bindings(void)
+{
+  vector<Binding *> out;
+  for (Frame *f = top.get(); f; f = f->parent.get())
+    out.push_back(&f->binding);
+  std::reverse(out.begin(), out.end());
+  return out;
+}
 
 bool Environment::in_hold(string x)
 {
-  for (int i = 0; i < hold.size(); i++)
-    if (hold.at(i).name == x) return true;
+  for (Frame *f = top.get(); f; f = f->parent.get())
+    if (f->binding.name == x) return true;
   return false;
 }
 
@@ -48,9 +225,8 @@ string Environment::to_string()
 {
   std::string out{"Environment{ \n"};
 
-  for (int i = 0; i < hold.size(); i++)
-    out +=
-        "\t(" + hold.at(i).name + "," + hold.at(i).value->to_string() + ")\n";
+  for (Binding *b : bindings())
+    out += "\t(" + b->name + "," + b->value->to_string() + ")\n";
   out += "}\n";
   return out;
 }
@@ -59,7 +235,14 @@ std::shared_ptr<SMLClos> SMLClos::New(std::string var,
                                       std::shared_ptr<AstNode> ast_node,
                                       Environment env)
 {
-  return std::shared_ptr<SMLClos>(new SMLClos(ast_node, env, var));
+  struct Make : SMLClos {
+    Make(std::shared_ptr<AstNode> ast_node, Environment env, std::string var)
+        : SMLClos(ast_node, env, var)
+    {
+    }
+  };
+  return std::allocate_shared<Make>(SlabAllocator<Make>(SlabKind::Clos),
+                                    ast_node, env, var);
 }
 std::shared_ptr<SMLClos> SMLClos::New(std::shared_ptr<SMLValue> v)
 {
@@ -68,8 +251,24 @@ std::shared_ptr<SMLClos> SMLClos::New(std::shared_ptr<SMLValue> v)
   else
     return std::dynamic_pointer_cast<SMLClos>(v);
 }
+// local: whether nothing evaluated in scope can keep its environment, so a
+// frame made for it may live on the stack (analyzeEscapes)
+static bool local(std::shared_ptr<AstNode> scope)
+{
+  return !scope->is_branch() ||
+         !std::static_pointer_cast<AstBranch>(scope)->captures();
+}
+
 std::shared_ptr<SMLValue> SMLClos::eval(std::shared_ptr<SMLValue> x)
 {
+  if (jit) {
+    std::shared_ptr<SMLValue> out = jit->call(*this, x);
+    if (out) return out;
+  }
+  if (local(last)) {
+    Frame frame;
+    return ::eval(env.push(frame, var, x), last);
+  }
   return ::eval(env.add(var, x), last);
 }
 
@@ -84,6 +283,12 @@ SMLClos::SMLClos(std::shared_ptr<AstNode> last_, Environment envr,
 
 void SMLClos::envSet(Environment env_) { env = env_; }
 
+void SMLClos::jitBind(std::shared_ptr<JitGroup> group, int index)
+{
+  jit = group;
+  jit_index = index;
+}
+
 std::string SMLClos::to_string(void)
 {
   return "[" + var + " => " + last->to_string() + "]";
@@ -100,6 +305,12 @@ SMLUnit::SMLUnit(void) { tag = "Unit"; }
 
 string SMLBool::to_string(void) { return (*this ? "true" : "false"); }
 
+void SMLBool::render(ValuePrinter &p)
+{
+  p.out.write(p.typed ? (tfval ? "[Bool, true]" : "[Bool, false]")
+                      : (tfval ? "true" : "false"));
+}
+
 std::shared_ptr<SMLBool> SMLBool::New(std::shared_ptr<class SMLValue> v)
 {
   if (v->type() == "Bool")
@@ -110,7 +321,10 @@ std::shared_ptr<SMLBool> SMLBool::New(std::shared_ptr<class SMLValue> v)
 
 std::shared_ptr<SMLBool> SMLBool::New(bool b)
 {
-  return std::shared_ptr<SMLBool>(new SMLBool(b));
+  struct Make : SMLBool {
+    Make(bool b) : SMLBool(b) {}
+  };
+  return std::allocate_shared<Make>(SlabAllocator<Make>(SlabKind::Bool), b);
 }
 
 SMLBool::SMLBool(bool b)
@@ -122,7 +336,14 @@ SMLBool::SMLBool(bool b)
 std::shared_ptr<SMLPair> SMLPair::New(std::shared_ptr<SMLValue> right,
                                       std::shared_ptr<SMLValue> left)
 {
-  return std::shared_ptr<SMLPair>(new SMLPair(right, left));
+  struct Make : SMLPair {
+    Make(std::shared_ptr<SMLValue> r, std::shared_ptr<SMLValue> l)
+        : SMLPair(r, l)
+    {
+    }
+  };
+  return std::allocate_shared<Make>(SlabAllocator<Make>(SlabKind::Pair), right,
+                                    left);
 }
 
 std::shared_ptr<SMLPair> SMLPair::New(std::shared_ptr<class SMLValue> v,
@@ -132,14 +353,16 @@ std::shared_ptr<SMLPair> SMLPair::New(std::shared_ptr<class SMLValue> v,
   return std::dynamic_pointer_cast<SMLPair>(v);
 } // for already the right type
 
-string SMLPair::to_string(void)
-{
-  return "(" + rs->to_string() + "," + ls->to_string() + ")";
-}
-string SMLPair::to_string_typed(void)
+string SMLPair::to_string(void) { return printed(this, false); }
+string SMLPair::to_string_typed(void) { return printed(this, true); }
+
+void SMLPair::render(ValuePrinter &p)
 {
-  return "[Pair, (" + rs->to_string_typed() + ", " + ls->to_string_typed() +
-         ")]";
+  p.out.write(p.typed ? "[Pair, (" : "(");
+  p.later(p.typed ? ")]" : ")");
+  p.later(ls.get());
+  p.later(p.typed ? ", " : ",");
+  p.later(rs.get());
 }
 
 std::shared_ptr<SMLValue> SMLPair::first()
@@ -161,6 +384,210 @@ SMLPair::SMLPair(SMLValue *r, SMLValue *l)
   tag = "PairUp";
 }
 
+SMLTuple::SMLTuple(std::shared_ptr<SMLValue> *f, int n_)
+{
+  fields = f;
+  n = n_;
+  tag = "Tuple";
+}
+
+template <int N> static std::shared_ptr<SMLTuple> inlineTuple(int)
+{
+  struct Make : SMLTuple {
+    std::shared_ptr<SMLValue> store[N];
+    Make() : SMLTuple(store, N) {}
+  };
+  return std::allocate_shared<Make>(std::allocator<Make>());
+}
+
+template <int... N>
+static std::array<std::shared_ptr<SMLTuple> (*)(int), sizeof...(N)>
+tupleMakers(std::integer_sequence<int, N...>)
+{
+  return {{&inlineTuple<N>...}};
+}
+
+std::shared_ptr<SMLTuple> SMLTuple::New(int n)
+{
+  static const auto makers =
+      tupleMakers(std::make_integer_sequence<int, TUPLE_INLINE + 1>());
+  if (n <= TUPLE_INLINE) return makers[n](n);
+  struct Make : SMLTuple { // too big to be worth a size of its own
+    std::vector<std::shared_ptr<SMLValue>> store;
+    Make(int n) : SMLTuple(nullptr, n), store(n) { fields = store.data(); }
+  };
+  return std::make_shared<Make>(n);
+}
+
+std::shared_ptr<SMLTuple> SMLTuple::New(std::shared_ptr<class SMLValue> v,
+                                        string msg)
+{
+  if (v->type() != "Tuple") throw RunTimeError("Bad Tuple Cast: " + msg);
+  return std::static_pointer_cast<SMLTuple>(v);
+}
+
+string SMLTuple::to_string(void) { return printed(this, false); }
+string SMLTuple::to_string_typed(void) { return printed(this, true); }
+
+void SMLTuple::render(ValuePrinter &p)
+{
+  p.out.write(p.typed ? "[Tuple, (" : "(");
+  p.later(p.typed ? ")]" : ")");
+  for (int k = n - 1; k >= 0; k--) {
+    p.later(fields[k].get());
+    if (k) p.later(p.typed ? ", " : ",");
+  }
+}
+
+SMLVector::SMLVector(size_t n) : elements(n)
+{
+  tag = "Vector";
+  countBytes(elements.capacity() * sizeof(int));
+}
+
+SMLVector::~SMLVector() { countBytes(-long(elements.capacity() * sizeof(int))); }
+
+std::shared_ptr<SMLVector> SMLVector::New(size_t n)
+{
+  struct Make : SMLVector {
+    Make(size_t n) : SMLVector(n) {}
+  };
+  std::shared_ptr<SMLVector> out = std::make_shared<Make>(n);
+  if (n > EVAL_POLL_INTERVAL) context().checkBytes();
+  return out;
+}
+
+std::shared_ptr<SMLVector> SMLVector::New(std::shared_ptr<class SMLValue> v,
+                                          string msg)
+{
+  if (v->type() != "Vector") throw RunTimeError(msg);
+  return std::static_pointer_cast<SMLVector>(v);
+}
+
+string SMLVector::to_string(void) { return printed(this, false); }
+string SMLVector::to_string_typed(void) { return printed(this, true); }
+
+void SMLVector::render(ValuePrinter &p)
+{
+  p.out.write(p.typed ? "[Vector, [" : "[");
+  for (size_t k = 0; k < elements.size(); k++) {
+    if (k) p.out.put(',');
+    p.out.integer(elements[k]);
+  }
+  p.out.write(p.typed ? "]]" : "]");
+}
+
+SMLString::SMLString(void) { tag = "String"; }
+
+std::shared_ptr<SMLString> SMLString::Blank(void)
+{
+  struct Make : SMLString {};
+  return std::allocate_shared<Make>(SlabAllocator<Make>(SlabKind::String));
+}
+
+std::shared_ptr<SMLString> SMLString::New(std::string_view s)
+{
+  std::shared_ptr<SMLString> out = Blank();
+  out->n = s.size();
+  if (s.size() <= INLINE) {
+    memcpy(out->inline_chars, s.data(), s.size());
+    out->chars = out->inline_chars;
+    return out;
+  }
+  std::shared_ptr<std::string> b = std::make_shared<std::string>(s);
+  out->chars = b->data();
+  out->buffer = b;
+  return out;
+}
+
+std::shared_ptr<SMLString> SMLString::New(std::shared_ptr<const void> owner,
+                                          std::string_view s)
+{
+  if (s.size() <= INLINE) return New(s);
+  std::shared_ptr<SMLString> out = Blank();
+  out->n = s.size();
+  out->chars = s.data();
+  out->buffer = owner;
+  return out;
+}
+
+std::shared_ptr<SMLString> SMLString::New(std::shared_ptr<class SMLValue> v,
+                                          string msg)
+{
+  if (v->type() != "String") throw RunTimeError(msg);
+  return std::static_pointer_cast<SMLString>(v);
+}
+
+std::shared_ptr<SMLString> SMLString::Join(std::shared_ptr<SMLString> l,
+                                           std::shared_ptr<SMLString> r)
+{
+  if (!l->n) return r;
+  if (!r->n) return l;
+  size_t n = l->n + r->n;
+  int depth = 1 + std::max(l->depth, r->depth);
+  if (n <= INLINE || depth > MAX_DEPTH) {
+    std::string joined(n, '\0');
+    l->copy(&joined[0]);
+    r->copy(&joined[l->n]);
+    return New(joined);
+  }
+  std::shared_ptr<SMLString> out = Blank();
+  out->n = n;
+  out->depth = depth;
+  out->left = l;
+  out->right = r;
+  return out;
+}
+
+void SMLString::copy(char *out)
+{
+  if (!left) {
+    memcpy(out, chars, n);
+    return;
+  }
+  left->copy(out);
+  right->copy(out + left->n);
+}
+
+std::string_view SMLString::view(void)
+{
+  if (left)
+    std::call_once(flat, [this]() {
+      std::shared_ptr<std::string> b = std::make_shared<std::string>(n, '\0');
+      copy(&(*b)[0]);
+      chars = b->data();
+      buffer = b;
+    });
+  return std::string_view(chars, n);
+}
+
+std::shared_ptr<SMLString> SMLString::slice(size_t at, size_t len)
+{
+  std::string_view s = view(); // sets buffer, for a rope
+  return New(buffer, s.substr(at, len));
+}
+
+string SMLString::to_string(void) { return string(view()); }
+
+string SMLString::to_string_typed(void)
+{
+  return "[String, \"" + to_string() + "\"]";
+}
+
+void SMLString::render(ValuePrinter &p)
+{
+  if (p.typed) p.out.write("[String, \"");
+  p.out.write(view());
+  if (p.typed) p.out.write("\"]");
+}
+
+void SMLInt::render(ValuePrinter &p)
+{
+  if (p.typed) p.out.write("[Int, ");
+  p.out.integer(val);
+  if (p.typed) p.out.put(']');
+}
+
 SMLInt::SMLInt(int n)
 
 {
@@ -168,6 +595,268 @@ SMLInt::SMLInt(int n)
   tag = "Int";
 }
 
+// declare: Evaluates a declaration, the part of a let before `in`
+//
+// Environment env: The Environment the declaration is evaluated in
+// std::shared_ptr<AstBranch> d: A Val, Fun or Funs node, the last holding
+// the Fun nodes of a `fun ... and ...` group
+//
+// return Environment: env extended with the declared names
+
+Environment declare(Environment env, std::shared_ptr<AstBranch> d)
+{
+  Environment envp = env;
+  if (!d->jit() && (d->label() == Label::Fun || d->label() == Label::Funs))
+    d->jit(JitGroup::New(d));
+
+  if (d->label() == Label::Val) {
+    string x = std::dynamic_pointer_cast<AstString>(d->get(0))->get_string();
+    std::shared_ptr<AstNode> r = d->get(1);
+    std::shared_ptr<SMLValue> u = eval(env, r);
+    envp = env.add(x, u);
+  }
+
+  else if (d->label() == Label::Fun) {
+    std::shared_ptr<AstBranch> fun = d;
+    std::shared_ptr<SMLClos> c = SMLClos::New(
+        std::dynamic_pointer_cast<AstString>(fun->get(1))->get_string(),
+        fun->get(2), env);
+    envp = env.add(
+        std::dynamic_pointer_cast<AstString>(fun->get(0))->get_string(), c);
+    c->envSet(envp);
+    context().gc.track(c);
+    c->jitBind(d->jit(), 0);
+  }
+
+  else if (d->label() == Label::Funs) {
+    // every closure sees the environment holding all of them
+    std::vector<std::shared_ptr<SMLClos>> group(d->count());
+    for (int i = 0; i < d->count(); i++) {
+      std::shared_ptr<AstBranch> fun =
+          std::static_pointer_cast<AstBranch>(d->get(i));
+      group[i] = SMLClos::New(
+          std::static_pointer_cast<AstString>(fun->get(1))->get_string(),
+          fun->get(2), env);
+      envp = envp.add(
+          std::static_pointer_cast<AstString>(fun->get(0))->get_string(),
+          group[i]);
+      group[i]->jitBind(d->jit(), i);
+    }
+    for (std::shared_ptr<SMLClos> &c : group) {
+      c->envSet(envp);
+      context().gc.track(c);
+    }
+  }
+
+  else
+    throw ParseError("Tried to call Let on " + d->to_string());
+  return envp;
+}
+
+static bool isInt(std::shared_ptr<SMLValue> const &v)
+{
+  return v->type() == "Int";
+}
+
+static int intOf(std::shared_ptr<SMLValue> const &v)
+{
+  return *static_cast<SMLInt *>(v.get());
+}
+
+// intop: Applies an arithmetic or comparison operator to two ints. Division
+// by zero is an error; dividing the least int by -1 wraps, as the other
+// operators do, rather than trapping.
+static std::shared_ptr<SMLValue> intop(AstBranch *ast, int x, int y)
+{
+  Label l = ast->label();
+  switch (l) {
+  case Label::Plus:
+    return SMLInt::New(x + y);
+  case Label::Minus:
+    return SMLInt::New(x - y);
+  case Label::Times:
+    return SMLInt::New(x * y);
+  case Label::Div:
+  case Label::Mod:
+    if (y == 0) throw RunTimeError("Division by zero at " + ast->where() + ".");
+    if (y == -1) return SMLInt::New(l == Label::Div ? 0u - unsigned(x) : 0);
+    return SMLInt::New(l == Label::Div ? x / y : x % y);
+  case Label::Less:
+    return SMLBool::New(x < y);
+  case Label::Equals:
+    return SMLBool::New(x == y);
+  default:
+    throw ParseError("Attempted operation on invalid operator" +
+                     label_to_string(l));
+  }
+}
+
+// intops: The generic arithmetic and comparison nodes, which check each
+// operand as soon as it is evaluated
+//
+// std::shared_ptr<SMLValue> val1: the left operand
+// std::shared_ptr<SMLValue> val2: the right one, nullptr if not yet evaluated
+//
+// return std::shared_ptr<SMLValue>: an SMLInt or an SMLBool
+
+static std::shared_ptr<SMLValue> intops(Environment &env,
+                                        std::shared_ptr<AstBranch> ast,
+                                        std::shared_ptr<SMLValue> val1,
+                                        std::shared_ptr<SMLValue> val2)
+{
+  bool cmp = ast->label() == Label::Less || ast->label() == Label::Equals;
+  if (ast->label() == Label::Equals && val1->type() == "String") {
+    if (!val2) val2 = eval(env, ast->get(1));
+    if (val2->type() != "String") throw ParseError("CMPOPS v2: ");
+    ast->special(Special::Generic); // not an int comparison
+    return SMLBool::New(sameText(static_cast<SMLString *>(val1.get())->view(),
+                                 static_cast<SMLString *>(val2.get())->view()));
+  }
+  if (!isInt(val1))
+    throw ParseError(cmp ? "CMPOPS v1: "
+                         : "INTOPS v1: " + val1->to_string_typed());
+  if (!val2) val2 = eval(env, ast->get(1));
+  if (!isInt(val2))
+    throw ParseError(cmp ? "CMPOPS v2: "
+                         : "INTOPS v2: " + val2->to_string_typed());
+  return intop(ast.get(), intOf(val1), intOf(val2));
+}
+
+// Arguments evalCurried takes from one chain of App nodes; more than this
+// and the innermost Apps run on their own
+const int CURRIED_MAX = 8;
+
+// bindCurried: Applies the function with parameter var, body and
+// environment fenv to the arguments of the App nodes apps[0..n), evaluated
+// in env. While arguments remain and the body is a fn, its parameter is
+// bound at once instead of making the closure applying the function would
+// return. Frames are on the stack when the body finally run makes no
+// closures.
+static std::shared_ptr<SMLValue>
+bindCurried(Environment &env, AstBranch **apps, int n, Environment fenv,
+            std::string const &var, std::shared_ptr<AstNode> body, bool stack)
+{
+  std::shared_ptr<SMLValue> x = eval(env, apps[0]->get(1));
+  if (n > 1 && body->label() == Label::Lam) {
+    AstBranch *lam = static_cast<AstBranch *>(body.get());
+    std::string const &y =
+        static_cast<AstString *>(lam->get(0).get())->get_string();
+    if (!stack)
+      return bindCurried(env, apps + 1, n - 1, fenv.add(var, x), y,
+                         lam->get(1), stack);
+    Frame frame;
+    return bindCurried(env, apps + 1, n - 1, fenv.push(frame, var, x), y,
+                       lam->get(1), stack);
+  }
+  std::shared_ptr<SMLValue> out;
+  if (stack) {
+    Frame frame;
+    out = eval(fenv.push(frame, var, x), body);
+  }
+  else
+    out = eval(fenv.add(var, x), body);
+  // the function returned something other than a fn, to apply to the rest
+  for (int k = 1; k < n; k++) {
+    std::shared_ptr<SMLClos> c = SMLClos::New(out);
+    out = c->eval(eval(env, apps[k]->get(1)));
+  }
+  return out;
+}
+
+// evalCurried: Evaluates f a1 ... an, n > 1, as the nested App nodes would
+// but without the closures in between: a function whose body is a fn is
+// applied to as many arguments as it has parameters in one go (see
+// bindCurried). A partial application still returns a closure, and a
+// function with a single parameter is called as usual, native code and all.
+//
+// std::shared_ptr<AstBranch> ast: the outermost App
+
+static std::shared_ptr<SMLValue> evalCurried(Environment &env,
+                                             std::shared_ptr<AstBranch> &ast)
+{
+  AstBranch *apps[CURRIED_MAX]; // innermost, so first argument, first
+  int n = 0;
+  std::shared_ptr<AstNode> head = ast;
+  while (head->label() == Label::App && n < CURRIED_MAX) {
+    apps[n++] = static_cast<AstBranch *>(head.get());
+    head = apps[n - 1]->get(0);
+  }
+  std::reverse(apps, apps + n);
+
+  std::shared_ptr<SMLValue> f = eval(env, head);
+  for (int k = 0; k < n;) {
+    std::shared_ptr<SMLClos> c = SMLClos::New(f);
+    if (k + 1 == n || c->body()->label() != Label::Lam) {
+      f = c->eval(eval(env, apps[k++]->get(1)));
+      continue;
+    }
+    // the parameters the arguments left fill, and the body they reach
+    std::shared_ptr<AstNode> body = c->body();
+    for (int m = k + 1; m < n && body->label() == Label::Lam; m++)
+      body = static_cast<AstBranch *>(body.get())->get(1);
+    return bindCurried(env, apps + k, n - k, c->environment(), c->param(),
+                       c->body(), local(body));
+  }
+  return f;
+}
+
+// evalSpecial: Evaluates a node that has specialized itself. When a guard
+// fails the node turns Generic and finishes with the values already in hand,
+// so nothing is evaluated twice.
+
+static std::shared_ptr<SMLValue> evalSpecial(Environment &env,
+                                             std::shared_ptr<AstBranch> &ast,
+                                             Special special)
+{
+  if (special == Special::Curried) return evalCurried(env, ast);
+  std::shared_ptr<SMLValue> v1 = eval(env, ast->get(0));
+  if (special == Special::Call) {
+    if (v1->type() != "Clos") {
+      ast->special(Special::Generic);
+      SMLClos::New(v1); // throws the generic error
+    }
+    return static_cast<SMLClos *>(v1.get())->eval(eval(env, ast->get(1)));
+  }
+  if (!isInt(v1)) {
+    ast->special(Special::Generic);
+    return intops(env, ast, v1, nullptr);
+  }
+  if (special == Special::IntConst)
+    return intop(ast.get(), intOf(v1), ast->constant());
+  std::shared_ptr<SMLValue> v2 = eval(env, ast->get(1));
+  if (!isInt(v2)) {
+    ast->special(Special::Generic);
+    return intops(env, ast, v1, v2);
+  }
+  return intop(ast.get(), intOf(v1), intOf(v2));
+}
+
+// printLine: What print writes for v. Kept out of eval, whose frame would
+// otherwise grow by a printer.
+
+static __attribute__((noinline)) void printLine(Output &out, SMLValue *v)
+{
+  ValuePrinter(out, false)(v);
+  out.put('\n');
+}
+
+// evalLocal: Evaluates `let val x = e in body end` with x's frame on the
+// stack. Kept out of eval so the frame only costs stack space in a let.
+//
+// std::shared_ptr<AstBranch> d: the Val node
+// std::shared_ptr<AstNode> body: a scope that makes no closures
+//
+// return std::shared_ptr<SMLValue>: the value of body
+
+static __attribute__((noinline)) std::shared_ptr<SMLValue>
+evalLocal(Environment &env, std::shared_ptr<AstBranch> d,
+          std::shared_ptr<AstNode> body)
+{
+  Frame frame;
+  string x = std::dynamic_pointer_cast<AstString>(d->get(0))->get_string();
+  return eval(env.push(frame, x, eval(env, d->get(1))), body);
+}
+
 // eval: The work horse of the eval engine
 //
 // Environment env: The Environment within which to find vars
@@ -177,6 +866,13 @@ SMLInt::SMLInt(int n)
 
 std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
 {
+  EvalContext &ctx = context();
+  if (--tick <= 0) {
+    ctx.poll();
+    if (!PARALLEL.enabled) ctx.gc.poll();
+  }
+  if (static_cast<char *>(__builtin_frame_address(0)) < stack_floor)
+    throw LimitExceeded("Stack exhausted (" + ctx.usage().to_string() + ")");
   if (last->is_leaf()) {
     std::shared_ptr<AstLeaf> leaf = std::dynamic_pointer_cast<AstLeaf>(last);
     if (leaf->label() == Label::Bool) {
@@ -185,16 +881,20 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
     else if (leaf->label() == Label::Int) {
       return SMLInt::New(leaf->val());
     }
+    else if (leaf->label() == Label::Unit) {
+      return SMLUnit::New();
+    }
     else
       throw ParseError("found new literal type!");
   }
   else if (last->is_branch()) {
-    std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(last);
+    std::shared_ptr<AstBranch> ast = std::static_pointer_cast<AstBranch>(last);
+    Special special = ast->special();
+    if (special != Special::Unseen && special != Special::Generic)
+      return evalSpecial(env, ast, special);
 
     if (ast->label() == Label::If) {
       std::shared_ptr<SMLBool> v0 = SMLBool::New(eval(env, ast->get(0)));
-      string err = "Type error in condition at " + ast->where() +
-                   ". Expected a boolean value.";
       if (*v0)
         return eval(env, ast->get(1));
       else
@@ -204,64 +904,12 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
       return eval(env, ast->get(0));
     }
     else if (ast->label() == Label::Let) {
-
-      std::shared_ptr<AstNode> b;
       std::shared_ptr<AstBranch> d =
           std::dynamic_pointer_cast<AstBranch>(ast->get(0));
-      b = ast->get(1);
-      Environment envp = env;
-      if (!(d->is_branch()))
-        throw ParseError("expected ast");
-
-      else if (d->label() == Label::Val) {
-        string x =
-            std::dynamic_pointer_cast<AstString>(d->get(0))->get_string();
-        std::shared_ptr<AstNode> r = d->get(1);
-        std::shared_ptr<SMLValue> u = eval(env, r);
-        envp = env.add(x, u);
-      }
-
-      else if (d->label() == Label::Fun) {
-        std::shared_ptr<AstBranch> fun = d;
-        std::shared_ptr<SMLClos> c = SMLClos::New(
-            std::dynamic_pointer_cast<AstString>(fun->get(1))->get_string(),
-            fun->get(2), env);
-        envp = env.add(
-            std::dynamic_pointer_cast<AstString>(fun->get(0))->get_string(), c);
-        c->envSet(envp);
-      }
-
-      else if (d->label() == Label::Funs) {
-        std::shared_ptr<AstBranch> funs = d;
-        std::shared_ptr<AstBranch> fun;
-        std::shared_ptr<SMLClos> c;
-        std::vector<std::shared_ptr<SMLClos>> to_set;
-        do { // eat second half
-          fun = std::dynamic_pointer_cast<AstBranch>(funs->get(1));
-          c = SMLClos::New(
-              std::dynamic_pointer_cast<AstString>(fun->get(1))->get_string(),
-              fun->get(2), envp);
-          envp = envp.add(
-              std::dynamic_pointer_cast<AstString>(fun->get(0))->get_string(),
-              c);
-          to_set.push_back(c);
-
-        } while (funs->get(0)->label() == Label::Funs &&
-                 (funs = std::dynamic_pointer_cast<AstBranch>(funs->get(0))));
-        fun = std::dynamic_pointer_cast<AstBranch>(funs->get(0));
-        c = SMLClos::New(
-            std::dynamic_pointer_cast<AstString>(fun->get(1))->get_string(),
-            fun->get(2), envp);
-        envp = envp.add(
-            std::dynamic_pointer_cast<AstString>(fun->get(0))->get_string(), c);
-        to_set.push_back(c);
-        for (std::shared_ptr<SMLClos> c : to_set)
-          c->envSet(envp);
-      }
-
-      else
-        throw ParseError("Tried to call Let on " + d->to_string());
-      return eval(envp, b);
+      if (!d || !(d->is_branch())) throw ParseError("expected ast");
+      if (d->label() == Label::Val && local(ast->get(1)))
+        return evalLocal(env, d, ast->get(1));
+      return eval(declare(env, d), ast->get(1));
     }
     else if (ast->label() == Label::Lam) {
       return SMLClos::New(
@@ -269,15 +917,19 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
           ast->get(1), env);
     }
     else if (ast->label() == Label::App) {
+      if (ast->get(0)->label() == Label::App) {
+        ast->special(Special::Curried);
+        return evalCurried(env, ast);
+      }
       std::shared_ptr<SMLClos> v1 = SMLClos::New(eval(env, ast->get(0)));
       std::shared_ptr<SMLValue> v2 = eval(env, ast->get(1));
+      if (ast->special() == Special::Unseen) ast->special(Special::Call);
       return v1->eval(v2);
     }
     else if (ast->label() == Label::Var) {
       string x =
           std::dynamic_pointer_cast<AstString>(ast->get(0))->get_string();
-      string err = "Unbound variable at " + ast->where() + ". ";
-      return env.lookup(x, err);
+      return env.lookup(x);
     }
     else if (ast->label() == Label::Or) {
       std::shared_ptr<SMLBool> e0, e1;
@@ -300,45 +952,84 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
         return e1;
       }
     }
-    else if (in_vector(INTOPS, ast->string_label())) {
-      std::shared_ptr<SMLInt> v1, v2;
-      std::shared_ptr<SMLValue> val1, val2;
-      // better return SMLInt
-      val1 = eval(env, ast->get(0));
-      v1 = SMLInt::New(val1, "INTOPS v1: " + val1->to_string_typed());
-      val2 = eval(env, ast->get(1));
-      v2 = SMLInt::New(val2, "INTOPS v2: " + val2->to_string_typed());
-      if (ast->label() == Label::Plus) {
-        return *v1 + *v2;
+    else if (ast->label() == Label::Plus || ast->label() == Label::Minus ||
+             ast->label() == Label::Times || ast->label() == Label::Div ||
+             ast->label() == Label::Mod || ast->label() == Label::Equals ||
+             ast->label() == Label::Less) {
+      std::shared_ptr<SMLValue> out =
+          intops(env, ast, eval(env, ast->get(0)), nullptr);
+      if (ast->special() == Special::Unseen) { // both were ints
+        std::shared_ptr<AstBranch> r =
+            std::dynamic_pointer_cast<AstBranch>(ast->get(1));
+        if (r && r->label() == Label::Literal &&
+            r->get(0)->label() == Label::Int) {
+          ast->constant(std::static_pointer_cast<AstLeaf>(r->get(0))->val());
+          ast->special(Special::IntConst);
+        }
+        else
+          ast->special(Special::IntInt);
       }
-      else if (ast->label() == Label::Minus)
-        return *v1 - *v2;
-      else if (ast->label() == Label::Times)
-        return *v1 * *v2;
-      else if (ast->label() == Label::Div)
-        return *v1 / *v2;
-      else if (ast->label() == Label::Mod)
-        return *v1 % *v2;
-      else
-        throw ParseError("Attempted operation on invalid operator" +
-                         ast->string_label());
-    }
-    else if (in_vector(CMPOPS, ast->string_label())) { // FIXME
-
-      std::shared_ptr<SMLInt> v1, v2;
-      // better return SMLInt
-      v1 = SMLInt::New(eval(env, ast->get(0)), "CMPOPS v1: ");
-      v2 = SMLInt::New(eval(env, ast->get(1)), "CMPOPS v2: ");
-      if (ast->label() == Label::Less)
-        return *v1 < *v2;
-      else if (ast->label() == Label::Equals)
-        return *v1 == *v2;
-      else
-        throw ParseError("Attempted operation on invalid operator" +
-                         ast->string_label());
+      return out;
     }
     else if (ast->label() == Label::PairUp) {
-      return SMLPair::New(eval(env, ast->get(0)), eval(env, ast->get(1)));
+      std::shared_ptr<SMLValue> v1, v2;
+      if (PARALLEL.enabled && ast->fork()) {
+        parallelInvoke(
+            [&]() {
+              ContextScope scope(&ctx);
+              v1 = eval(env, ast->get(0));
+            },
+            [&]() { v2 = eval(env, ast->get(1)); });
+        return SMLPair::New(v1, v2);
+      }
+      v1 = eval(env, ast->get(0));
+      return SMLPair::New(v1, eval(env, ast->get(1)));
+    }
+    else if (ast->label() == Label::Tuple) {
+      std::shared_ptr<SMLTuple> t = SMLTuple::New(ast->count());
+      for (int k = 0; k < ast->count(); k++)
+        t->at(k) = eval(env, ast->get(k));
+      return t;
+    }
+    else if (ast->label() == Label::Select) {
+      std::shared_ptr<SMLValue> v = eval(env, ast->get(0));
+      int k = std::static_pointer_cast<AstLeaf>(ast->get(1))->val();
+      if (v->type() == "Tuple" &&
+          k <= std::static_pointer_cast<SMLTuple>(v)->size())
+        return std::static_pointer_cast<SMLTuple>(v)->at(k - 1);
+      if (v->type() == "PairUp" && k <= 2) {
+        std::shared_ptr<SMLPair> p = std::static_pointer_cast<SMLPair>(v);
+        return k == 1 ? p->first() : p->last();
+      }
+      throw RunTimeError("Attempted to select field #" + std::to_string(k) +
+                         " of " + v->to_string_typed() + " at " +
+                         ast->where() + ".");
+    }
+    else if (ast->label() == Label::Concat) {
+      std::shared_ptr<SMLValue> l = eval(env, ast->get(0));
+      std::shared_ptr<SMLValue> r;
+      if (l->type() == "String") r = eval(env, ast->get(1));
+      if (!r || r->type() != "String")
+        throw RunTimeError("Attempted to join " +
+                           (r ? r : l)->to_string_typed() + " with ^ at " +
+                           ast->where() + ".");
+      return SMLString::Join(std::static_pointer_cast<SMLString>(l),
+                             std::static_pointer_cast<SMLString>(r));
+    }
+    else if (ast->label() == Label::Vec) {
+      std::shared_ptr<SMLVector> v = SMLVector::New(ast->count());
+      for (int k = 0; k < ast->count(); k++) {
+        std::shared_ptr<SMLValue> e = eval(env, ast->get(k));
+        if (e->type() != "Int")
+          throw RunTimeError("Vector elements are ints, saw " +
+                             e->to_string_typed() + " at " + ast->where() +
+                             ".");
+        v->ints()[k] = *std::static_pointer_cast<SMLInt>(e);
+      }
+      return v;
+    }
+    else if (ast->label() == Label::Prim) {
+      return callBuiltin(env, ast);
     }
     else if (ast->label() == Label::First) {
       return SMLPair::New(
@@ -355,13 +1046,15 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
           ->last();
     }
     else if (ast->label() == Label::Seq) {
-      eval(env, ast->get(0));
-      return eval(env, ast->get(1));
+      int last = ast->count() - 1;
+      for (int i = 0; i < last; i++)
+        eval(env, ast->get(i));
+      return eval(env, ast->get(last));
     }
     else if (ast->label() == Label::Print) {
       std::shared_ptr<SMLValue> tv;
       tv = eval(env, ast->get(0));
-      std::cout << tv->to_string()+"\n";
+      printLine(ctx.out, tv.get());
       return SMLUnit::New();
     }
     else if (ast->label() == Label::Not) {
@@ -372,8 +1065,9 @@ std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last)
                            ast->string_label() + "\"");
     }
   }
-  else if (last->is_string()) {
-    throw ParseError("String leaf not handled!");
+  else if (last->is_string()) { // a literal's text, shared rather than copied
+    std::shared_ptr<AstString> s = std::static_pointer_cast<AstString>(last);
+    return SMLString::New(s, s->get_string());
   }
   else {
     throw ParseError("Badly constructed raw AstNode");
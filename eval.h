@@ -1,46 +1,171 @@
 #pragma once
+#include "gc.h"
+#include "output.h"
 #include "parser.h"
+#include "slab.h"
 #include "tokenstream.h"
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
 
 union Value {
   int i;
   bool b;
 };
 
-extern std::vector<std::string> INTOPS;
-extern std::vector<std::string> CMPOPS;
+// Evaluation steps between checks of the deadline and limits
+const int EVAL_POLL_INTERVAL = 4096;
+
+// Limits: what one evaluation may use, each unlimited while 0
+struct Limits {
+  long steps{0};     // calls to eval
+  long bytes{0};     // live values, beyond those there when it started
+  double seconds{0}; // wall-clock time
+  bool any(void) const { return steps || bytes || seconds > 0; }
+};
+
+// applied by interpret to every program run (--max-steps, --max-bytes,
+// --max-seconds)
+extern Limits LIMITS;
+
+// Usage: what the current evaluation has used so far
+struct Usage {
+  long steps;
+  long bytes;
+  double seconds;
+  std::string to_string(void);
+};
+
+// EvalContext: everything an evaluation writes to or is limited by. Each
+// thread evaluates against its own context, so interpreters running side by
+// side never share state.
+//
+// Limits cost nothing per step: eval counts down to the next poll, which is
+// brought forward when fewer steps are left than EVAL_POLL_INTERVAL, and the
+// poll adds up the steps and checks the clock and the bytes the thread's
+// values hold. The bytes are those of the thread that started the evaluation:
+// a worker running part of it under --parallel counts neither its own nor
+// that thread's, and reports the last figure that thread saw. Closures are not run as native code under limits or a
+// deadline, since it never polls. Recursion too deep for the thread's stack
+// is stopped the same way rather than crashing, in native code too (jit.h).
+struct EvalContext {
+  Output out; // what print writes, into std::cout unless redirected
+  std::chrono::steady_clock::time_point deadline{
+      std::chrono::steady_clock::time_point::max()};
+  CycleCollector gc; // the recursive closures made in this context
+  Limits limits;
+
+  void start(Limits l); // begins an evaluation under l, counting from zero
+  // whether a deadline or limit may stop the evaluation
+  bool bounded(void) const
+  {
+    return limits.any() ||
+           deadline != std::chrono::steady_clock::time_point::max();
+  }
+  Usage usage(void);
+  void poll(void);
+  void checkBytes(void); // after a large allocation, without waiting to poll
+
+    private:
+  std::atomic<long> steps{0}; // up to the last poll
+  long base_bytes{0};
+  std::thread::id owner;           // the thread whose bytes are counted
+  std::atomic<long> seen_bytes{0}; // as of the owner's last look
+  std::chrono::steady_clock::time_point started{
+      std::chrono::steady_clock::now()};
+};
+
+EvalContext &context(void); // the calling thread's context
+
+// stackFloor: How far down this thread's stack evaluation may go, null if
+// unknown
+char *stackFloor(void);
+
+// ContextScope: makes a context current on this thread for its lifetime
+class ContextScope {
+    public:
+  ContextScope(EvalContext *ctx);
+  ~ContextScope();
+
+    private:
+  EvalContext *saved;
+};
 
 class SMLValue {
     public:
   static std::shared_ptr<SMLValue> New(void);
-  string type(void);
+  string const &type(void);
   void setTag(string t);
   virtual string to_string(void);
   virtual string to_string_typed(void);
+  // render: Writes the value out, leaving any values it holds to p
+  virtual void render(class ValuePrinter &p);
 
     protected:
   SMLValue(void) { tag = "Uninitialized"; }
   string tag;
 };
 
+// ValuePrinter: writes values as to_string, or when typed to_string_typed,
+// would spell them, straight into an Output. The values inside a pair or
+// tuple wait on a stack of their own rather than the call stack, so a long
+// chain of pairs prints in linear time and constant stack.
+class ValuePrinter {
+    public:
+  ValuePrinter(Output &out_, bool typed_) : out(out_), typed(typed_) {}
+  void operator()(SMLValue *v); // v and everything in it
+
+  // what to write after the current value, last pushed first
+  void later(SMLValue *v) { pending.push_back({v, {}}); }
+  void later(std::string_view s) { pending.push_back({nullptr, s}); }
+
+  Output &out;
+  const bool typed;
+
+    private:
+  struct Item {
+    SMLValue *v; // null for plain text
+    std::string_view s;
+  };
+  std::vector<Item> pending;
+};
+
 struct Binding {
   string name;
   std::shared_ptr<SMLValue> value;
 };
 
+// Frame: one binding and the frames it extends. Environments share their
+// older frames, so extending one costs a single frame.
+struct Frame {
+  Binding binding;
+  std::shared_ptr<Frame> parent;
+  Frame() {}
+  Frame(Binding b, std::shared_ptr<Frame> p) : binding(b), parent(p) {}
+  ~Frame();
+};
+
 class Environment {
     public:
   Environment() {}
   Environment add(string name, std::shared_ptr<SMLValue> v);
-  std::shared_ptr<SMLValue> lookup(string x, string err);
-  Environment(const Environment &t);
+  // push: like add, but the frame is the caller's. Only for scopes that make
+  // no closures (see escape.h), since nothing may refer to it once it is gone.
+  Environment push(Frame &frame, string name, std::shared_ptr<SMLValue> v);
+  std::shared_ptr<SMLValue> lookup(string x);
   std::string to_string(void);
+  bool in_hold(string x);
 
     protected:
-  vector<Binding> hold{}; // this would make a great hash map
-  bool in_hold(string x);
+  friend class ImageWriter;
+  friend class ImageReader;
+  friend class CycleCollector;
+  vector<Binding *> bindings(void); // oldest first
+  std::shared_ptr<Frame> top;       // the newest binding
 };
 
 class SMLClos : public SMLValue {
@@ -51,11 +176,23 @@ class SMLClos : public SMLValue {
   std::shared_ptr<SMLValue> eval(std::shared_ptr<SMLValue> x);
   std::string to_string(void);
   void envSet(Environment env_);
+  void jitBind(std::shared_ptr<class JitGroup> group, int index);
+  // for calls binding several parameters at once (evalCurried)
+  std::shared_ptr<AstNode> const &body(void) { return last; }
+  std::string const &param(void) { return var; }
+  Environment const &environment(void) { return env; }
 
     protected:
+  friend class JitGroup;
+  friend class Kernel;
+  friend class ImageWriter;
+  friend class ImageReader;
+  friend class CycleCollector;
   std::shared_ptr<AstNode> last;
   Environment env;
   std::string var;
+  std::shared_ptr<class JitGroup> jit;
+  int jit_index{0};
   SMLClos(std::shared_ptr<AstNode> last_, Environment envr, std::string var_);
 };
 
@@ -72,6 +209,7 @@ class SMLBool : public SMLValue {
     public:
   operator bool() const { return tfval; }
   string to_string(void) override;
+  void render(ValuePrinter &p) override;
 
   static std::shared_ptr<SMLBool> New(std::shared_ptr<class SMLValue> v);
   static std::shared_ptr<SMLBool> New(bool b);
@@ -91,6 +229,7 @@ class SMLPair : public SMLValue {
 
   string to_string(void) override;
   string to_string_typed(void) override;
+  void render(ValuePrinter &p) override;
 
   std::shared_ptr<SMLValue> first();
   std::shared_ptr<SMLValue> last();
@@ -102,11 +241,98 @@ class SMLPair : public SMLValue {
   std::shared_ptr<SMLValue> ls;
 };
 
+// Tuples up to this many fields keep them in the same allocation as the
+// tuple and its reference count
+const int TUPLE_INLINE = 16;
+
+// SMLTuple: three or more values; pairs stay SMLPair
+class SMLTuple : public SMLValue {
+    public:
+  static std::shared_ptr<SMLTuple> New(int n); // fields start out null
+  static std::shared_ptr<SMLTuple> New(std::shared_ptr<class SMLValue> v,
+                                       string msg);
+
+  string to_string(void) override;
+  string to_string_typed(void) override;
+  void render(ValuePrinter &p) override;
+
+  int size(void) { return n; }
+  std::shared_ptr<SMLValue> &at(int k) { return fields[k]; } // from 0
+
+    protected:
+  SMLTuple(std::shared_ptr<SMLValue> *f, int n_);
+  std::shared_ptr<SMLValue> *fields; // inside the derived object
+  int n;
+};
+
+// SMLVector: ints stored unboxed and side by side (vector.cc)
+class SMLVector : public SMLValue {
+    public:
+  static std::shared_ptr<SMLVector> New(size_t n); // zeroed
+  static std::shared_ptr<SMLVector> New(std::shared_ptr<class SMLValue> v,
+                                        string msg);
+
+  string to_string(void) override;
+  string to_string_typed(void) override;
+  void render(ValuePrinter &p) override;
+
+  std::vector<int> &ints(void) { return elements; }
+  ~SMLVector();
+
+    protected:
+  SMLVector(size_t n);
+  std::vector<int> elements;
+};
+
+// SMLString: text in one of three forms (text.h). Up to INLINE chars are
+// kept inside the value. Longer text is a view into a buffer the value
+// shares, such as the literal's AST node, so evaluating a literal or taking
+// a substring copies nothing. `^` of longer strings makes a rope node,
+// flattened into a buffer of its own the first time its chars are read.
+class SMLString : public SMLValue {
+    public:
+  static const size_t INLINE = 22;
+  static const int MAX_DEPTH = 48; // a deeper rope is flattened at once
+
+  static std::shared_ptr<SMLString> New(std::string_view s); // copied
+  static std::shared_ptr<SMLString> New(std::shared_ptr<const void> owner,
+                                        std::string_view s);
+  static std::shared_ptr<SMLString> New(std::shared_ptr<class SMLValue> v,
+                                        string msg);
+  static std::shared_ptr<SMLString> Join(std::shared_ptr<SMLString> l,
+                                         std::shared_ptr<SMLString> r);
+
+  string to_string(void) override;
+  string to_string_typed(void) override;
+  void render(ValuePrinter &p) override;
+
+  size_t size(void) const { return n; }
+  std::string_view view(void);
+  std::shared_ptr<SMLString> slice(size_t at, size_t len); // shares chars
+
+    protected:
+  SMLString(void);
+  static std::shared_ptr<SMLString> Blank(void);
+  void copy(char *out); // the chars of a rope, without flattening it
+  size_t n{0};
+  const char *chars{nullptr};
+  std::shared_ptr<const void> buffer; // holds chars unless they are inline
+  std::shared_ptr<SMLString> left, right; // of a rope
+  int depth{0};
+  std::once_flag flat;
+  char inline_chars[INLINE];
+};
+
 class SMLInt : public SMLValue {
     public:
+  operator int() const { return val; }
+
   static std::shared_ptr<SMLInt> New(int n)
   {
-    return std::shared_ptr<SMLInt>(new SMLInt(n));
+    struct Make : SMLInt { // gives allocate_shared the constructor
+      Make(int n) : SMLInt(n) {}
+    };
+    return std::allocate_shared<Make>(SlabAllocator<Make>(SlabKind::Int), n);
   }
 
   static std::shared_ptr<SMLInt> New(std::shared_ptr<class SMLValue> v,
@@ -152,12 +378,15 @@ class SMLInt : public SMLValue {
   }
 
   string to_string(void) override { return std::to_string(val); }
+  void render(ValuePrinter &p) override;
 
     protected:
   SMLInt(int n);
   int val;
 };
 
+Environment declare(Environment env, std::shared_ptr<AstBranch> d);
+
 std::shared_ptr<SMLValue> eval(Environment env, std::shared_ptr<AstNode> last);
 
 std::shared_ptr<SMLValue> eval(std::shared_ptr<AstNode> last);
@@ -0,0 +1,242 @@
+// MiniML-frontend-bench: times the lexer and parser on generated programs.
+//
+//   MiniML-frontend-bench [--shape NAME] [--size N] [--steps K] [--reps R]
+//                         [--digits D]
+//
+// Each shape is generated at N, 2N, ... 2^(K-1) N units and run through
+// InputStream, TokenStream (whose constructor runs analyze) and SMLParser
+// separately, keeping the best of R runs of each. Besides throughput it
+// prints each stage's growth exponent against the size before: about 1 for
+// linear work, so anything well above 1 is superlinear.
+#include "parser.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// every allocation the bench makes, to report allocations per node
+static std::atomic<long> allocations{0};
+
+void *operator new(size_t n)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Options {
+  std::string shape; // empty for all of them
+  int size{2000};
+  int steps{4};
+  int reps{3};
+  int digits{9}; // in the literals of the ints shape
+};
+
+// Shape: a family of programs, built from `units` repetitions of one idea
+struct Shape {
+  const char *name;
+  const char *what;
+  std::function<std::string(int units, Options const &)> make;
+};
+
+static std::string literal(int k, int digits)
+{
+  std::string s = std::to_string(k % 9 + 1);
+  while (s.size() < digits)
+    s += char('0' + (k * 7 + s.size()) % 10);
+  return s;
+}
+
+static const std::vector<Shape> SHAPES = {
+    {"nest", "lets nested `units` deep",
+     [](int n, Options const &) {
+       std::string s;
+       for (int k = 0; k < n; k++)
+         s += "let val x" + std::to_string(k) + " = " +
+              (k ? "x" + std::to_string(k - 1) + " + 1" : "1") + " in\n";
+       s += "x" + std::to_string(n - 1);
+       for (int k = 0; k < n; k++)
+         s += " end";
+       return s + "\n";
+     }},
+    {"seq", "one ( ; ) block of `units` expressions",
+     [](int n, Options const &) {
+       std::string s = "(";
+       for (int k = 0; k < n; k++)
+         s += "print " + std::to_string(k) + ";\n";
+       return s + "0)\n";
+     }},
+    {"and", "one fun ... and ... group of `units` functions",
+     [](int n, Options const &) {
+       std::string s = "fun f0 x = if x = 0 then 0 else f1 (x - 1)\n";
+       for (int k = 1; k < n; k++)
+         s += "and f" + std::to_string(k) + " x = if x = 0 then " +
+              std::to_string(k) + " else f" + std::to_string((k + 1) % n) +
+              " (x - 1)\n";
+       return s + ";\nf0 10\n";
+     }},
+    {"comment", "`units` declarations, each under a ten-line comment",
+     [](int n, Options const &) {
+       std::string s;
+       for (int k = 0; k < n; k++) {
+         s += "(* declaration " + std::to_string(k) + "\n";
+         for (int l = 0; l < 9; l++)
+           s += "   the quick brown fox jumps over the lazy dog, again\n";
+         s += "*)\nval v" + std::to_string(k) + " = " + std::to_string(k) +
+              ";\n";
+       }
+       return s;
+     }},
+    {"ints", "`units` declarations, each summing ten long literals",
+     [](int n, Options const &o) {
+       std::string s;
+       for (int k = 0; k < n; k++) {
+         s += "val v" + std::to_string(k) + " = ";
+         for (int t = 0; t < 10; t++)
+           s += (t ? " + " : "") + literal(k + t, o.digits);
+         s += ";\n";
+       }
+       return s;
+     }},
+};
+
+static long countNodes(std::shared_ptr<AstNode> node)
+{
+  long n = 1;
+  if (node->is_branch()) {
+    std::shared_ptr<AstBranch> b = std::static_pointer_cast<AstBranch>(node);
+    for (int k = 0; k < b->count(); k++)
+      n += countNodes(b->get(k));
+  }
+  return n;
+}
+
+// Run: one size of one shape
+struct Run {
+  int units;
+  size_t bytes;
+  long tokens{0}, nodes{0};
+  double read{1e30}, lex{1e30}, parse{1e30}; // best seconds of each stage
+  long parse_allocations{0};
+  std::string error;
+};
+
+static double since(std::chrono::steady_clock::time_point t)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t)
+      .count();
+}
+
+static Run measure(Shape const &shape, int units, Options const &o)
+{
+  std::string text = shape.make(units, o);
+  Run r{units, text.size()};
+  for (int rep = 0; rep < o.reps && r.error.empty(); rep++) {
+    try {
+      auto t = std::chrono::steady_clock::now();
+      InputStream in{text};
+      r.read = std::min(r.read, since(t));
+      t = std::chrono::steady_clock::now();
+      TokenStream tks(shape.name, &in);
+      r.lex = std::min(r.lex, since(t));
+      r.tokens = tks.remaining();
+      long before = allocations.load();
+      t = std::chrono::steady_clock::now();
+      std::shared_ptr<AstBranch> prog = SMLParser(&tks).program();
+      r.parse = std::min(r.parse, since(t));
+      r.parse_allocations = allocations.load() - before;
+      r.nodes = countNodes(prog);
+    }
+    catch (LexError &e) {
+      r.error = e.what();
+    }
+  }
+  return r;
+}
+
+// growth: the exponent k in time ~ size^k between two runs
+static double growth(double t0, double t1, double s0, double s1)
+{
+  return std::log(t1 / t0) / std::log(s1 / s0);
+}
+
+static void report(Shape const &shape, Options const &o)
+{
+  std::printf("\n%s: %s\n", shape.name, shape.what);
+  std::printf("%8s %10s %9s %9s %10s %10s %10s %11s %10s\n", "units", "bytes",
+              "tokens", "nodes", "read MB/s", "lex MB/s", "Mtok/s",
+              "Mnodes/s", "alloc/node");
+  Run last{0, 0};
+  for (int k = 0, units = o.size; k < o.steps; k++, units *= 2) {
+    Run r = measure(shape, units, o);
+    if (r.error.size()) {
+      std::printf("%8d %10zu  %s\n", units, r.bytes, r.error.c_str());
+      return;
+    }
+    double mb = r.bytes / 1e6;
+    std::printf("%8d %10zu %9ld %9ld %10.1f %10.1f %10.2f %11.2f %10.2f",
+                units, r.bytes, r.tokens, r.nodes, mb / r.read, mb / r.lex,
+                r.tokens / r.lex / 1e6, r.nodes / r.parse / 1e6,
+                double(r.parse_allocations) / r.nodes);
+    if (last.units) {
+      double lex = growth(last.lex, r.lex, last.bytes, r.bytes);
+      double parse = growth(last.parse, r.parse, last.bytes, r.bytes);
+      std::printf("  growth lex %.2f parse %.2f%s", lex, parse,
+                  std::max(lex, parse) > 1.3 ? "  superlinear" : "");
+    }
+    std::printf("\n");
+    last = r;
+  }
+}
+
+static void *runAll(void *arg)
+{
+  Options &o = *static_cast<Options *>(arg);
+  for (Shape const &shape : SHAPES)
+    if (o.shape.empty() || o.shape == shape.name) report(shape, o);
+  return nullptr;
+}
+
+int main(int argc, char **argv)
+{
+  Options o;
+  for (int a = 1; a < argc; a++) {
+    if (!strcmp(argv[a], "--shape") && a + 1 < argc)
+      o.shape = argv[++a];
+    else if (!strcmp(argv[a], "--size") && a + 1 < argc)
+      o.size = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--steps") && a + 1 < argc)
+      o.steps = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--reps") && a + 1 < argc)
+      o.reps = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--digits") && a + 1 < argc)
+      o.digits = atoi(argv[++a]);
+    else {
+      std::fprintf(stderr,
+                   "usage: %s [--shape nest|seq|and|comment|ints] [--size N] "
+                   "[--steps K] [--reps R] [--digits D]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+  if (o.size < 1 || o.steps < 1 || o.reps < 1) return 2;
+
+  // the parser and the trees it builds recurse once per level of nesting
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, size_t(1) << 30);
+  pthread_t t;
+  if (pthread_create(&t, &attr, runAll, &o)) return 1;
+  pthread_join(t, nullptr);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "gc.h"
+#include "eval.h"
+#include <unordered_map>
+
+GcOptions GC;
+
+void CycleCollector::track(std::shared_ptr<SMLClos> c)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  closures.push_back(c);
+  since++;
+}
+
+size_t CycleCollector::tracked(void)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return closures.size();
+}
+
+void CycleCollector::poll(void)
+{
+  if (!GC.enabled || since < next) return;
+  collect(); // which leaves only the survivors tracked
+  size_t live = tracked();
+  // collections cost time proportional to what survives them
+  next = std::max(GC.threshold, live);
+}
+
+size_t CycleCollector::collect(void)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<std::shared_ptr<SMLClos>> live;
+  live.reserve(closures.size());
+  for (std::weak_ptr<SMLClos> &w : closures)
+    if (std::shared_ptr<SMLClos> c = w.lock()) live.push_back(c);
+
+  // the frames of their environments, each once; they are shared
+  std::vector<std::shared_ptr<Frame>> frames;
+  std::unordered_map<void *, long> outside;
+  for (std::shared_ptr<SMLClos> &c : live)
+    for (std::shared_ptr<Frame> f = c->env.top;
+         f && f.use_count() > 0 && !outside.count(f.get()); f = f->parent) {
+      outside[f.get()] = 0;
+      frames.push_back(f);
+    }
+
+  // references from outside, less the ones in `live` and `frames`
+  for (std::shared_ptr<SMLClos> &c : live)
+    outside[static_cast<SMLValue *>(c.get())] = c.use_count() - 1;
+  for (std::shared_ptr<Frame> &f : frames)
+    outside[f.get()] = f.use_count() - 1;
+  auto inside = [&](void *p) {
+    auto found = outside.find(p);
+    if (found != outside.end()) found->second--;
+  };
+  for (std::shared_ptr<SMLClos> &c : live)
+    inside(c->env.top.get());
+  for (std::shared_ptr<Frame> &f : frames) {
+    inside(f->parent.get());
+    inside(f->binding.value.get());
+  }
+
+  std::vector<void *> reached;
+  std::unordered_map<void *, bool> marked;
+  std::unordered_map<void *, SMLClos *> closure;
+  std::unordered_map<void *, Frame *> frame;
+  for (std::shared_ptr<SMLClos> &c : live)
+    closure[static_cast<SMLValue *>(c.get())] = c.get();
+  for (std::shared_ptr<Frame> &f : frames)
+    frame[f.get()] = f.get();
+  for (auto &o : outside)
+    if (o.second > 0) {
+      marked[o.first] = true;
+      reached.push_back(o.first);
+    }
+  auto reach = [&](void *p) {
+    if (outside.count(p) && !marked[p]) {
+      marked[p] = true;
+      reached.push_back(p);
+    }
+  };
+  while (reached.size()) {
+    void *p = reached.back();
+    reached.pop_back();
+    if (closure.count(p))
+      reach(closure[p]->env.top.get());
+    else {
+      reach(frame[p]->parent.get());
+      reach(frame[p]->binding.value.get());
+    }
+  }
+
+  size_t freed = 0;
+  closures.clear();
+  frames.clear();
+  for (std::shared_ptr<SMLClos> &c : live)
+    if (marked[static_cast<SMLValue *>(c.get())])
+      closures.push_back(c);
+    else {
+      c->env = Environment(); // breaks the cycle
+      freed++;
+    }
+  since = 0;
+  return freed; // the garbage goes when `live` does
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Closures tracked between collections, at least
+const size_t GC_THRESHOLD = 10000;
+
+struct GcOptions {
+  bool enabled{true};
+  size_t threshold{GC_THRESHOLD};
+};
+
+extern GcOptions GC;
+
+// CycleCollector: reclaims closures that are only kept alive by each other.
+// Values are reference counted, and the only way to build a cycle is to give
+// a closure an environment holding itself or its `and` siblings (envSet).
+// Such closures are tracked here. A collection counts, for each of them and
+// each frame of their environments, the references coming from those
+// closures and frames. Anything with more references than that is held from
+// outside and is a root. Whatever the roots cannot reach through captured
+// environments is garbage, and clearing its environment lets the reference
+// counts free it.
+//
+// Collecting is only safe while no other thread is using this context's
+// values, so the evaluator does it at its poll points when evaluation is
+// sequential, and the driver between top-level items.
+class CycleCollector {
+    public:
+  void track(std::shared_ptr<class SMLClos> c);
+  size_t collect(void); // returns the number of closures freed
+  void poll(void);      // collects once enough closures have been tracked
+  size_t tracked(void);
+
+    private:
+  std::mutex lock; // closures may be made by several threads at once
+  std::vector<std::weak_ptr<SMLClos>> closures;
+  size_t since{0}; // tracked since the last collection
+  size_t next{GC_THRESHOLD};
+};
@@ -0,0 +1,415 @@
+#include "image.h"
+#include "astcache.h"
+#include "jit.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#ifndef MINIML_VERSION
+#define MINIML_VERSION "unknown"
+#endif
+
+// An image is a header, then the AST records, the values, the bindings and
+// the strings. The first `session` bindings are the saved environment.
+struct ImageHeader {
+  char magic[4];
+  char version[16];
+  uint32_t format;
+  uint32_t ast_format;
+  uint32_t asts;
+  uint32_t values;
+  uint32_t bindings;
+  uint32_t strings; // bytes
+  uint32_t session;
+  uint32_t prints;
+};
+
+enum ImageKind : uint8_t {
+  ImageInt,
+  ImageBool,
+  ImageUnit,
+  ImagePair,
+  ImageClos,
+  ImageTuple,
+  ImageVector,
+  ImageString
+};
+
+const uint32_t IMAGE_NONE = 0xffffffff;
+
+struct ImageValue {
+  uint8_t kind;
+  uint8_t unused[3];
+  int32_t n;      // Int and Bool: the value. Clos: index in its fun group
+  uint32_t a;     // Pair: first. Clos: body
+  uint32_t b;     // Pair: last. Clos: Fun/Funs declaration, or IMAGE_NONE
+  uint32_t env;   // Clos: first binding of its environment. Tuple: of its
+  uint32_t count; // fields, which have no names. And how many
+  uint32_t var;   // Clos: parameter name. Vector, String: contents. As an
+  uint32_t len;   // offset and length into the strings
+};
+
+struct ImageBinding {
+  uint32_t name;
+  uint32_t len;
+  uint32_t value;
+};
+
+static const char IMAGE_MAGIC[4] = {'M', 'L', 'I', 'M'};
+
+// ImageWriter: numbers values and AST nodes as it reaches them. Each value
+// gets its slot when first seen and is filled in later from a queue, so
+// closures that capture themselves need no special case.
+class ImageWriter {
+    public:
+  uint32_t value(std::shared_ptr<SMLValue> v);
+  uint32_t environment(Environment &env);
+  void finish(void);
+
+  std::vector<AstRecord> asts;
+  std::vector<ImageValue> values;
+  std::vector<ImageBinding> bindings;
+  std::string strings;
+
+    private:
+  uint32_t node(std::shared_ptr<AstNode> n);
+  void text(std::string s, uint32_t &at, uint32_t &len);
+  void fill(uint32_t id);
+
+  std::unordered_map<SMLValue *, uint32_t> value_ids;
+  std::vector<std::shared_ptr<SMLValue>> objects; // indexed by value id
+  std::unordered_map<AstNode *, uint32_t> node_ids;
+};
+
+void ImageWriter::text(std::string s, uint32_t &at, uint32_t &len)
+{
+  at = strings.size();
+  len = s.size();
+  strings += s;
+}
+
+uint32_t ImageWriter::value(std::shared_ptr<SMLValue> v)
+{
+  auto found = value_ids.find(v.get());
+  if (found != value_ids.end()) return found->second;
+  uint32_t id = values.size();
+  value_ids[v.get()] = id;
+  objects.push_back(v);
+  values.push_back(ImageValue{});
+  return id;
+}
+
+// ImageWriter::node: The record number of an AST node, writing out the tree
+// it heads if it has not been reached through an earlier one
+uint32_t ImageWriter::node(std::shared_ptr<AstNode> n)
+{
+  auto found = node_ids.find(n.get());
+  if (found != node_ids.end()) return found->second;
+  std::vector<AstNode *> order;
+  uint32_t first = asts.size();
+  flattenAst(n, asts, strings, &order);
+  for (uint32_t i = 0; i < order.size(); i++)
+    node_ids.emplace(order[i], first + i); // earlier copies keep their number
+  return first;
+}
+
+uint32_t ImageWriter::environment(Environment &env)
+{
+  std::vector<ImageBinding> own;
+  for (Binding *b : env.bindings()) {
+    ImageBinding r;
+    text(b->name, r.name, r.len);
+    r.value = value(b->value);
+    own.push_back(r);
+  }
+  uint32_t first = bindings.size();
+  bindings.insert(bindings.end(), own.begin(), own.end());
+  return first;
+}
+
+void ImageWriter::fill(uint32_t id)
+{
+  std::shared_ptr<SMLValue> v = objects[id];
+  ImageValue r{};
+  string type = v->type();
+  if (type == "Int") {
+    r.kind = ImageInt;
+    r.n = *std::dynamic_pointer_cast<SMLInt>(v);
+  }
+  else if (type == "Bool") {
+    r.kind = ImageBool;
+    r.n = *SMLBool::New(v);
+  }
+  else if (type == "PairUp") {
+    std::shared_ptr<SMLPair> p = SMLPair::New(v, "");
+    r.kind = ImagePair;
+    r.a = value(p->first());
+    r.b = value(p->last());
+  }
+  else if (type == "Tuple") {
+    std::shared_ptr<SMLTuple> t = SMLTuple::New(v, "");
+    std::vector<ImageBinding> own;
+    for (int k = 0; k < t->size(); k++)
+      own.push_back(ImageBinding{0, 0, value(t->at(k))});
+    r.kind = ImageTuple;
+    r.env = bindings.size();
+    r.count = own.size();
+    bindings.insert(bindings.end(), own.begin(), own.end());
+  }
+  else if (type == "Vector") {
+    std::vector<int> &ints = SMLVector::New(v, "")->ints();
+    r.kind = ImageVector;
+    text(std::string(reinterpret_cast<char *>(ints.data()),
+                     ints.size() * sizeof(int)),
+         r.var, r.len);
+  }
+  else if (type == "String") {
+    r.kind = ImageString;
+    text(SMLString::New(v, "")->to_string(), r.var, r.len);
+  }
+  else if (type == "Clos") {
+    std::shared_ptr<SMLClos> c = SMLClos::New(v);
+    std::shared_ptr<AstBranch> decl = c->jit ? c->jit->declaration() : nullptr;
+    r.kind = ImageClos;
+    // the declaration first, so the body is numbered inside it
+    r.b = decl ? node(decl) : IMAGE_NONE;
+    r.n = c->jit_index;
+    r.a = node(c->last);
+    r.env = environment(c->env);
+    r.count = bindings.size() - r.env;
+    text(c->var, r.var, r.len);
+  }
+  else
+    r.kind = ImageUnit;
+  values[id] = r;
+}
+
+void ImageWriter::finish(void)
+{
+  for (uint32_t id = 0; id < values.size(); id++)
+    fill(id);
+}
+
+bool saveImage(std::string path, Environment &env, bool prints)
+{
+  ImageWriter w;
+  w.environment(env);
+  uint32_t session = w.bindings.size();
+  w.finish();
+
+  ImageHeader h{};
+  memcpy(h.magic, IMAGE_MAGIC, 4);
+  strncpy(h.version, MINIML_VERSION, sizeof(h.version) - 1);
+  h.format = IMAGE_FORMAT;
+  h.ast_format = AST_CACHE_FORMAT;
+  h.asts = w.asts.size();
+  h.values = w.values.size();
+  h.bindings = w.bindings.size();
+  h.strings = w.strings.size();
+  h.session = session;
+  h.prints = prints;
+
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) return false;
+  bool ok =
+      fwrite(&h, sizeof(h), 1, f) == 1 &&
+      fwrite(w.asts.data(), sizeof(AstRecord), w.asts.size(), f) ==
+          w.asts.size() &&
+      fwrite(w.values.data(), sizeof(ImageValue), w.values.size(), f) ==
+          w.values.size() &&
+      fwrite(w.bindings.data(), sizeof(ImageBinding), w.bindings.size(), f) ==
+          w.bindings.size() &&
+      fwrite(w.strings.data(), 1, w.strings.size(), f) == w.strings.size();
+  return fclose(f) == 0 && ok;
+}
+
+// ImageReader: rebuilds the values of a mapped image, checking every number
+// it follows and throwing std::out_of_range on anything that does not fit:
+// the AST's shape (AstReader), closure bodies and the functions native code
+// is bound to
+class ImageReader {
+    public:
+  ImageReader(const ImageHeader *h_) : h(h_) {}
+  Environment restore(void);
+
+    private:
+  template <typename T> const T *section(uint64_t offset)
+  {
+    return reinterpret_cast<const T *>(reinterpret_cast<const char *>(h) +
+                                       offset);
+  }
+  std::shared_ptr<SMLValue> object(uint32_t id);
+  Environment environment(uint32_t first, uint32_t count);
+  std::string text(uint32_t at, uint32_t len);
+  std::shared_ptr<AstNode> node(uint32_t n);
+  void link(uint32_t id);
+
+  const ImageHeader *h;
+  const ImageValue *values;
+  const ImageBinding *bindings;
+  const char *strings;
+  std::vector<std::shared_ptr<AstNode>> nodes;
+  std::vector<std::shared_ptr<SMLValue>> objects;
+  std::vector<char> visiting; // pairs and tuples being built, to refuse cycles
+};
+
+std::string ImageReader::text(uint32_t at, uint32_t len)
+{
+  if (at > h->strings || len > h->strings - at)
+    throw std::out_of_range("image strings");
+  return std::string(strings + at, len);
+}
+
+std::shared_ptr<AstNode> ImageReader::node(uint32_t n)
+{
+  if (n >= nodes.size()) throw std::out_of_range("image AST");
+  return nodes[n];
+}
+
+// ImageReader::object: The value with a given number. Only pairs and tuples
+// are built here, since their parts must exist first; everything else
+// already is.
+std::shared_ptr<SMLValue> ImageReader::object(uint32_t id)
+{
+  if (id >= h->values) throw std::out_of_range("image values");
+  if (objects[id]) return objects[id];
+  if (visiting[id]) throw std::out_of_range("image pair cycle");
+  visiting[id] = 1;
+  const ImageValue &r = values[id];
+  if (r.kind == ImagePair) {
+    objects[id] = SMLPair::New(object(r.a), object(r.b));
+    return objects[id];
+  }
+  if (r.env > h->bindings || r.count > h->bindings - r.env || r.count < 3)
+    throw std::out_of_range("image tuple");
+  std::shared_ptr<SMLTuple> t = SMLTuple::New(r.count);
+  for (uint32_t k = 0; k < r.count; k++)
+    t->at(k) = object(bindings[r.env + k].value);
+  objects[id] = t;
+  return objects[id];
+}
+
+Environment ImageReader::environment(uint32_t first, uint32_t count)
+{
+  if (first > h->bindings || count > h->bindings - first)
+    throw std::out_of_range("image bindings");
+  Environment env;
+  for (uint32_t i = first; i < first + count; i++)
+    env = env.add(text(bindings[i].name, bindings[i].len),
+                  object(bindings[i].value));
+  return env;
+}
+
+// ImageReader::link: Patches a closure's environment and native code group
+void ImageReader::link(uint32_t id)
+{
+  const ImageValue &r = values[id];
+  std::shared_ptr<SMLClos> c = std::static_pointer_cast<SMLClos>(objects[id]);
+  c->env = environment(r.env, r.count);
+  context().gc.track(c);
+  if (r.b == IMAGE_NONE) return;
+  std::shared_ptr<AstBranch> decl =
+      std::dynamic_pointer_cast<AstBranch>(node(r.b));
+  if (!decl ||
+      (decl->label() != Label::Fun && decl->label() != Label::Funs))
+    throw std::out_of_range("image declaration");
+  int group = decl->label() == Label::Funs ? decl->count() : 1;
+  if (r.n < 0 || r.n >= group) throw std::out_of_range("image fun index");
+  // native code runs the declaration's function, so it must be the body
+  std::shared_ptr<AstBranch> fun =
+      group > 1 ? std::static_pointer_cast<AstBranch>(decl->get(r.n)) : decl;
+  if (fun->label() != Label::Fun || fun->get(2) != c->last)
+    throw std::out_of_range("image fun body");
+  if (!decl->jit()) decl->jit(JitGroup::New(decl));
+  c->jitBind(decl->jit(), r.n);
+}
+
+Environment ImageReader::restore(void)
+{
+  uint64_t at = sizeof(ImageHeader);
+  const AstRecord *asts = section<AstRecord>(at);
+  at += uint64_t(h->asts) * sizeof(AstRecord);
+  values = section<ImageValue>(at);
+  at += uint64_t(h->values) * sizeof(ImageValue);
+  bindings = section<ImageBinding>(at);
+  at += uint64_t(h->bindings) * sizeof(ImageBinding);
+  strings = section<char>(at);
+
+  AstReader reader(asts, h->asts, strings, h->strings, &nodes);
+  while (!reader.done())
+    reader.node();
+
+  objects.resize(h->values);
+  visiting.resize(h->values);
+  for (uint32_t id = 0; id < h->values; id++) {
+    const ImageValue &r = values[id];
+    if (r.kind == ImageInt)
+      objects[id] = SMLInt::New(r.n);
+    else if (r.kind == ImageBool)
+      objects[id] = SMLBool::New(r.n != 0);
+    else if (r.kind == ImageUnit)
+      objects[id] = SMLUnit::New();
+    else if (r.kind == ImageClos) {
+      if (!node(r.a)->is_branch()) throw std::out_of_range("image body");
+      objects[id] =
+          SMLClos::New(text(r.var, r.len), node(r.a), Environment());
+    }
+    else if (r.kind == ImageVector) {
+      std::string ints = text(r.var, r.len);
+      if (ints.size() % sizeof(int)) throw std::out_of_range("image vector");
+      std::shared_ptr<SMLVector> v = SMLVector::New(ints.size() / sizeof(int));
+      memcpy(v->ints().data(), ints.data(), ints.size());
+      objects[id] = v;
+    }
+    else if (r.kind == ImageString)
+      objects[id] = SMLString::New(text(r.var, r.len));
+    else if (r.kind != ImagePair && r.kind != ImageTuple)
+      throw std::out_of_range("image value kind");
+  }
+  for (uint32_t id = 0; id < h->values; id++)
+    if (values[id].kind == ImagePair || values[id].kind == ImageTuple)
+      object(id);
+  for (uint32_t id = 0; id < h->values; id++)
+    if (values[id].kind == ImageClos) link(id);
+  return environment(0, h->session);
+}
+
+bool loadImage(std::string path, Environment &env, bool &prints)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(ImageHeader))
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const ImageHeader *h = static_cast<const ImageHeader *>(map);
+  char version[sizeof(h->version)] = {};
+  strncpy(version, MINIML_VERSION, sizeof(version) - 1);
+  bool ok = !memcmp(h->magic, IMAGE_MAGIC, 4) &&
+            !memcmp(h->version, version, sizeof(version)) &&
+            h->format == IMAGE_FORMAT && h->ast_format == AST_CACHE_FORMAT &&
+            st.st_size == sizeof(ImageHeader) +
+                              uint64_t(h->asts) * sizeof(AstRecord) +
+                              uint64_t(h->values) * sizeof(ImageValue) +
+                              uint64_t(h->bindings) * sizeof(ImageBinding) +
+                              h->strings;
+  if (ok) {
+    try {
+      env = ImageReader(h).restore();
+      prints = h->prints;
+    }
+    catch (std::out_of_range &) {
+      ok = false;
+    }
+  }
+  munmap(map, st.st_size);
+  return ok;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "eval.h"
+
+// Bump whenever the layout in image.cc changes
+const uint32_t IMAGE_FORMAT = 5;
+
+// saveImage: Writes a top-level environment and everything reachable from
+// it (closures with their code and captured environments, pairs, scalars)
+// to a file. Values are numbered and refer to each other by number, so the
+// image does not depend on where anything was in memory.
+//
+// std::string path: the image file
+// Environment &env: the bindings to save
+// bool prints: whether any saved function might print
+//
+// return bool: false if the file could not be written
+
+bool saveImage(std::string path, Environment &env, bool prints);
+
+// loadImage: Restores an environment written by saveImage. Every value is
+// allocated first and the references between them are then patched in, so
+// nothing is evaluated again.
+//
+// std::string path: the image file
+// Environment &env: receives the bindings
+// bool &prints: receives the flag passed to saveImage
+//
+// return bool: false if the file is missing, damaged or from another version
+
+bool loadImage(std::string path, Environment &env, bool &prints);
@@ -0,0 +1,289 @@
+#include "incremental.h"
+#include <algorithm>
+#include <stdexcept>
+
+IncrementalParser::IncrementalParser(std::string sourcename, std::string text)
+    : name(sourcename)
+{
+  edit(0, 0, text);
+}
+
+bool IncrementalParser::Item::closed(void)
+{
+  return ast && tokens.size() && tokens.back().text == ";";
+}
+
+int IncrementalParser::lineOf(int offset)
+{
+  return std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin() -
+         1;
+}
+
+// IncrementalParser::moveLines: Updates where lines start for an edit that
+// has been made to source
+void IncrementalParser::moveLines(int offset, int removed,
+                                  std::string const &inserted)
+{
+  // lines starting inside the removed text began at newlines in it
+  size_t lo = std::upper_bound(lines.begin(), lines.end(), offset) -
+              lines.begin();
+  size_t hi = std::upper_bound(lines.begin(), lines.end(), offset + removed) -
+              lines.begin();
+  int delta = inserted.size() - removed;
+  for (size_t k = hi; k < lines.size(); k++)
+    lines[k] += delta;
+  std::vector<int> added;
+  for (int j = 0; j < inserted.size(); j++)
+    if (inserted[j] == '\n') added.push_back(offset + j + 1);
+  lines.erase(lines.begin() + lo, lines.begin() + hi);
+  lines.insert(lines.begin() + lo, added.begin(), added.end());
+}
+
+// Cursor: lines and columns of increasing offsets, counted the way the
+// lexer counts them: from column 1 on the first line and 0 on the others,
+// with a tab four columns wide
+struct Cursor {
+  std::string const &source;
+  std::vector<int> const &lines;
+  int line{-1};
+  int column{0};
+  int at{0};
+
+  Position operator()(int offset)
+  {
+    int l = std::upper_bound(lines.begin(), lines.end(), offset) -
+            lines.begin() - 1;
+    if (l != line || offset < at) {
+      line = l;
+      at = lines[l];
+      column = l == 0 ? 1 : 0;
+    }
+    for (; at < offset; at++)
+      column += at >= source.size() ? 1 // the space before the eof token
+                : source[at] == '\t' ? 4
+                : source[at] == '\r' ? 0
+                                     : 1;
+    return Position{line, column, offset};
+  }
+};
+
+// IncrementalParser::relex: Lexes the new source from `from`, a place an old
+// token started, until a token starts where an old item did once shifted
+// by the edit. The text from there on is what it was, and a line break
+// after the edit means its positions only move by whole lines. An item that
+// failed to parse is not found again, as its error may have been caused by
+// what came before it. The text
+// is lexed a window at a time, trusting only tokens that start two bytes
+// or more before the window ends, which is as far as the lexer looks ahead.
+//
+// int from: where to start lexing
+// int edit_end: the end of the inserted text, in the new source
+// int old_end: the end of the removed text, in the old source
+// int delta: how far the edit moved what follows it
+// int a: the first item that may be found again
+// std::vector<Lexeme> &out: receives the tokens before that item
+//
+// return int: the item found, items.size() if lexed to the end
+
+int IncrementalParser::relex(int from, int edit_end, int old_end, int delta,
+                             int a, std::vector<Lexeme> &out)
+{
+  int size = source.size();
+  int window = std::max(64, edit_end - from + 64);
+  for (;; window *= 2) {
+    int end = std::min(size, from + window);
+    try {
+      InputStream in{source.substr(from, end - from)};
+      TokenStream lexer(name, &in);
+      out.clear();
+      int k = a;
+      auto tk = lexer.lexed().begin();
+      for (Position p : lexer.positions()) {
+        int at = from + p.offset;
+        token text = *tk++;
+        if (at > size || (end < size && at > end - 2)) break;
+        while (k < items.size() && items[k].start + delta < at)
+          k++;
+        if (k < items.size() && items[k].start + delta == at &&
+            items[k].start >= old_end && items[k].ast &&
+            lineOf(edit_end) < lineOf(at))
+          return k;
+        out.push_back({text, at});
+      }
+      if (end == size) return items.size();
+    }
+    catch (LexError &) {
+      if (end == size) throw; // not for want of text
+    }
+  }
+}
+
+// IncrementalParser::stream: Tokens for the parser: the region from a
+// token on, then what the parser may look at after it, the first token of
+// item m and the end of the file
+TokenStream IncrementalParser::stream(std::vector<Lexeme> const &region,
+                                      size_t from, int m)
+{
+  list<token> tokens;
+  list<Position> starts;
+  Cursor place{source, lines};
+  for (size_t k = from; k < region.size(); k++) {
+    tokens.push_back(region[k].text);
+    starts.push_back(place(region[k].offset));
+  }
+  if (m < items.size() && items[m].tokens.size()) {
+    tokens.push_back(items[m].tokens[0].text);
+    starts.push_back(place(items[m].start));
+  }
+  tokens.push_back("eof");
+  starts.push_back(place(source.size() + 1));
+  return TokenStream(name, tokens, starts);
+}
+
+// IncrementalParser::reparse: Parses a region into items. An item that runs
+// on into item m takes that item's tokens into the region and is parsed
+// again; an item that fails to parse takes the rest of the region.
+//
+// std::vector<Lexeme> &region: the tokens, by offset in the source
+// int &m: the item after the region, moved on past any taken in
+//
+// return std::vector<Item>: the items
+
+std::vector<IncrementalParser::Item>
+IncrementalParser::reparse(std::vector<Lexeme> &region, int &m)
+{
+  std::vector<Item> out;
+  size_t pos = 0;
+  while (pos < region.size()) {
+    TokenStream tks = stream(region, pos, m);
+    SMLParser parser(&tks);
+    bool overran = false;
+    while (pos < region.size()) {
+      Item item{region[pos].offset};
+      int before = tks.remaining();
+      try {
+        item.ast = parser.item();
+      }
+      catch (LexError &) {
+        item.error = std::current_exception();
+      }
+      size_t used = before - tks.remaining();
+      if (pos + used > region.size()) {
+        overran = true;
+        break;
+      }
+      if (!item.error && used == 0)
+        item.error = std::make_exception_ptr(
+            ParseError("Unexpected token at " + tks.report() + "."));
+      if (item.error) {
+        item.ast = nullptr;
+        used = region.size() - pos;
+      }
+      for (size_t k = pos; k < pos + used; k++)
+        item.tokens.push_back({region[k].text, region[k].offset - item.start});
+      out.push_back(item);
+      pos += used;
+    }
+    if (!overran) break;
+    for (Lexeme &l : items[m].tokens)
+      region.push_back({l.text, items[m].start + l.offset});
+    m++;
+  }
+  return out;
+}
+
+// shiftLines: Moves the positions in a tree down by some lines
+static void shiftLines(std::shared_ptr<AstNode> node, int delta)
+{
+  if (!node->is_branch()) return;
+  std::shared_ptr<AstBranch> b = std::static_pointer_cast<AstBranch>(node);
+  std::string where = b->where();
+  size_t at = where.rfind(" line ");
+  if (at != std::string::npos) {
+    size_t digits = at + 6;
+    size_t end = where.find(' ', digits);
+    int line = std::stoi(where.substr(digits, end - digits));
+    b->where(where.substr(0, digits) + std::to_string(line + delta) +
+             where.substr(end));
+  }
+  for (int k = 0; k < b->count(); k++)
+    shiftLines(b->get(k), delta);
+}
+
+void IncrementalParser::edit(int offset, int removed, std::string inserted)
+{
+  if (offset < 0 || removed < 0 || offset + removed > source.size())
+    throw std::out_of_range("IncrementalParser::edit");
+  int old_end = offset + removed;
+  int edit_end = offset + inserted.size();
+  int delta = inserted.size() - removed;
+  int old_lines = lines.size();
+  source.replace(offset, removed, inserted);
+  moveLines(offset, removed, inserted);
+
+  // the tokens of items before a end two bytes or more before the edit, so
+  // lex the same; lexing restarts at a's first token
+  int a = std::upper_bound(items.begin(), items.end(), offset - 2,
+                           [](int o, Item const &i) { return o < i.start; }) -
+          items.begin() - 1;
+  int from = 0;
+  if (a < 0)
+    a = 0;
+  else
+    from = items[a].start;
+  // an item without its ';' was parsed looking at the token after it
+  int first = a > 0 && !items[a - 1].closed() ? a - 1 : a;
+
+  std::vector<Lexeme> region;
+  for (int k = first; k < a; k++)
+    for (Lexeme &l : items[k].tokens)
+      region.push_back({l.text, items[k].start + l.offset});
+  std::vector<Lexeme> fresh;
+  std::exception_ptr lex_error;
+  int m;
+  try {
+    m = relex(from, edit_end, old_end, delta, a, fresh);
+  }
+  catch (LexError &) {
+    lex_error = std::current_exception();
+    m = items.size();
+  }
+  last_relexed = fresh.size();
+  region.insert(region.end(), fresh.begin(), fresh.end());
+
+  int line_delta = lines.size() - old_lines;
+  for (int k = m; k < items.size(); k++) {
+    items[k].start += delta;
+    items[k].moved += line_delta; // caught up by program
+  }
+
+  std::vector<Item> parsed;
+  if (lex_error) {
+    // the rest of the source, relexed whole by any edit before its end
+    Item bad{first < a ? items[first].start : from};
+    bad.error = lex_error;
+    parsed.push_back(bad);
+  }
+  else
+    parsed = reparse(region, m);
+  last_reparsed = parsed.size();
+  items.erase(items.begin() + first, items.begin() + m);
+  items.insert(items.begin() + first, parsed.begin(), parsed.end());
+}
+
+std::shared_ptr<AstBranch> IncrementalParser::program(void)
+{
+  std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
+  out->label(Label::Program);
+  Position p = Cursor{source, lines}(items.size() ? items[0].start
+                                                  : source.size() + 1);
+  out->where(name + " line " + std::to_string(p.line_number) + " column " +
+             std::to_string(p.column_number));
+  for (Item &item : items) {
+    if (item.error) std::rethrow_exception(item.error);
+    if (item.moved) shiftLines(item.ast, item.moved);
+    item.moved = 0;
+    out->add(item.ast);
+  }
+  return out;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "parser.h"
+#include <exception>
+
+// IncrementalParser: a source kept parsed across edits, for an editor that
+// reparses after every keystroke. Tokens are kept with their byte offsets
+// and the program as top-level items, each a declaration, `use` or
+// expression with the semicolons after it. An edit relexes from the item it
+// falls in to the first item boundary past it, on a later line, where the
+// new text lexes as the old did, and reparses only the items in between.
+// Every other item keeps its tree, so the work done is proportional to the
+// items the edit touches rather than to the file.
+//
+// Trees are shared by the programs returned before and after an edit, so
+// passes that rewrite a tree (liftFunctions, analyzeEscapes, planParallel)
+// must not be run on them.
+class IncrementalParser {
+    public:
+  IncrementalParser(std::string sourcename, std::string text);
+
+  // edit: Replaces `removed` bytes at `offset` with `inserted`. Syntax
+  // errors are kept with the items they are in, for program to report.
+  void edit(int offset, int removed, std::string inserted);
+
+  // program: The Program for the current text, throwing the first error.
+  // Items that edits moved to other lines have their positions brought up
+  // to date here rather than on every edit.
+  std::shared_ptr<AstBranch> program(void);
+
+  std::string const &text(void) { return source; }
+  int relexed(void) { return last_relexed; }   // tokens lexed by the last edit
+  int reparsed(void) { return last_reparsed; } // items parsed by the last edit
+
+    private:
+  struct Lexeme {
+    token text;
+    int offset; // in the source, or from its item's start once in an item
+  };
+  struct Item {
+    int start; // of its first token
+    std::vector<Lexeme> tokens;
+    std::shared_ptr<AstBranch> ast; // nullptr if it did not parse
+    std::exception_ptr error;
+    int moved{0};      // lines the positions in ast are behind by
+    bool closed(void); // ends in ';', so what follows cannot change it
+  };
+
+  int lineOf(int offset);
+  void moveLines(int offset, int removed, std::string const &inserted);
+  int relex(int from, int edit_end, int old_end, int delta, int a,
+            std::vector<Lexeme> &out);
+  std::vector<Item> reparse(std::vector<Lexeme> &region, int &m);
+  TokenStream stream(std::vector<Lexeme> const &region, size_t from, int m);
+
+  std::string name;
+  std::string source;
+  std::vector<int> lines{0}; // the offset each line starts at
+  std::vector<Item> items;
+  int last_relexed{0};
+  int last_reparsed{0};
+};
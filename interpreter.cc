@@ -0,0 +1,87 @@
+#include "interpreter.h"
+#include "escape.h"
+#include "lift.h"
+#include "module.h"
+#include "parallel.h"
+
+std::shared_ptr<SMLValue> interpret(std::shared_ptr<AstBranch> prog,
+                                    Session &session)
+{
+  prog = liftFunctions(prog);
+  analyzeEscapes(prog);
+  session.prints = planParallel(prog, session.prints);
+  context().start(session.limits);
+  std::shared_ptr<SMLValue> result;
+  for (int k = 0; k < prog->count(); k++) {
+    std::shared_ptr<AstBranch> item =
+        std::dynamic_pointer_cast<AstBranch>(prog->get(k));
+    if (item->label() == Label::Val || item->label() == Label::Fun ||
+        item->label() == Label::Funs)
+      session.env = declare(session.env, item);
+    else {
+      result = eval(session.env, item);
+      if (session.echo) {
+        Output &out = context().out;
+        out.write("Out: ");
+        ValuePrinter(out, true)(result.get());
+        out.put('\n');
+      }
+    }
+    context().gc.poll();
+  }
+  return result;
+}
+
+std::shared_ptr<SMLValue> interpret(TokenStream tks, Session &session)
+{
+  std::shared_ptr<AstBranch> prog = SMLParser(&tks).program();
+  tks.checkEOF();
+  for (int k = 0; k < prog->count() && !session.use_files; k++) {
+    std::shared_ptr<AstBranch> item =
+        std::static_pointer_cast<AstBranch>(prog->get(k));
+    if (item->label() == Label::UseFile)
+      throw ParseError("use is not allowed here, at " + item->where() + ".");
+  }
+  return interpret(linkProgram(prog), session);
+}
+
+std::shared_ptr<SMLValue> interpret(std::shared_ptr<AstBranch> prog)
+{
+  Session session;
+  return interpret(prog, session);
+}
+
+Interpreter::Interpreter(Limits limits_) : limits(limits_)
+{
+  session.echo = false;
+  ctx.out.sink(&printed);
+}
+
+void Interpreter::output(std::ostream *sink)
+{
+  ctx.out.sink(sink ? sink : &printed);
+}
+
+Result Interpreter::evaluate(std::string_view source)
+{
+  Result r;
+  ContextScope scope(&ctx);
+  session.limits = limits;
+  session.use_files = use_files;
+  ctx.start(limits); // for the usage of a program that does not parse
+  try {
+    InputStream in{std::string(source)};
+    r.value = interpret(TokenStream("input", &in), session);
+  }
+  catch (LexError &err) {
+    r.error = err.what();
+  }
+  catch (std::exception &err) {
+    r.error = err.what();
+  }
+  r.usage = ctx.usage();
+  ctx.out.flush();
+  r.printed = printed.str();
+  printed.str("");
+  return r;
+}
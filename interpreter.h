@@ -0,0 +1,67 @@
+#pragma once
+#include "eval.h"
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// Session: top-level state that outlives a single program
+struct Session {
+  Environment env;
+  bool prints{false};    // whether a closure in env might print
+  Limits limits{LIMITS}; // for each program run in it
+  bool echo{true};       // reports each expression's value as "Out: ..."
+  bool use_files{true};  // whether a program may `use` files on the host
+};
+
+// interpret: Runs a program: declarations extend the session, expressions
+// are evaluated in it and their values reported
+//
+// std::shared_ptr<AstBranch> prog: a Program node
+// Session &session: the top-level environment
+//
+// return std::shared_ptr<SMLValue>: the last value, nullptr if none
+std::shared_ptr<SMLValue> interpret(std::shared_ptr<AstBranch> prog,
+                                    Session &session);
+std::shared_ptr<SMLValue> interpret(TokenStream tks, Session &session);
+std::shared_ptr<SMLValue> interpret(std::shared_ptr<AstBranch> prog);
+
+// Result: what one Interpreter::evaluate did
+struct Result {
+  std::shared_ptr<SMLValue> value; // of the last expression, null if none
+  std::string printed; // unless the interpreter prints into a stream
+  std::string error;   // why it stopped early, empty if it did not
+  Usage usage;
+
+  bool ok(void) const { return error.empty(); }
+  std::string to_string(void) const { return value ? value->to_string() : ""; }
+};
+
+// Interpreter: MiniML for programs that embed it. Each instance has its own
+// top-level environment, which every evaluate extends with its declarations
+// (up to an error, as in the REPL), and its own EvalContext: what print
+// writes, the limits and the cycle collector. Values are allocated from the
+// slabs of the thread evaluating them. Instances share nothing they write
+// to, so any number may run on different threads at once without locking;
+// one instance is used by one thread at a time. Whatever a program does,
+// including recursing too deep or dividing by zero in compiled code, ends up
+// in the Result's error rather than taking the host down. A program may not
+// `use` files unless use_files is set, since it could read any the host can.
+class Interpreter {
+    public:
+  Interpreter(Limits limits_ = Limits{});
+  Interpreter(Interpreter const &) = delete;
+
+  // evaluate: Runs a program, never throwing for what the program does
+  Result evaluate(std::string_view source);
+  // output: where print writes; null, the default, gathers it into each
+  // Result instead
+  void output(std::ostream *sink);
+
+  Limits limits;         // for each evaluate
+  bool use_files{false}; // lets programs `use` paths relative to the cwd
+
+    private:
+  Session session;
+  EvalContext ctx;
+  std::ostringstream printed;
+};
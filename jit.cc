@@ -0,0 +1,617 @@
+#include "jit.h"
+#include "parallel.h"
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define SML_JIT_SUPPORTED 1
+#else
+#define SML_JIT_SUPPORTED 0
+#endif
+
+JitOptions JIT;
+
+// Raised while compiling when a body leaves the supported subset
+class JitUnsupported : public LexError {
+    public:
+  JitUnsupported(string error_msg) : LexError(error_msg) {}
+};
+
+// jitPrint: the runtime half of `print` for compiled code
+//
+// int v: the raw value
+// int kind: a JitType cast to int
+
+static void jitPrint(int v, int kind)
+{
+  Output &out = context().out;
+  if (kind == static_cast<int>(JitType::Int)) {
+    out.integer(v);
+    out.put('\n');
+  }
+  else if (kind == static_cast<int>(JitType::Bool))
+    out.write(v ? "true\n" : "false\n");
+  else
+    out.write("()\n");
+}
+
+// Why native code gave up, passed to jitEscape: the stack ran out, or
+// division k of the group was by zero for Division + k
+enum JitEscape { Stack = 1, Division };
+
+// where JitGroup::call resumes when native code gives up, and why, while in
+// it
+static thread_local std::jmp_buf *escape = nullptr;
+static thread_local int escaped = 0;
+
+// NativeLimit: the stack floor a thread's native code checks on every call.
+// jitInterrupt moves it out of reach for threads running half of a pair;
+// chained says whether the thread's latest native call does, and only goes
+// false under limits_lock, so a call outside any pair is never interrupted.
+struct NativeLimit {
+  std::atomic<char *> floor{nullptr};
+  std::atomic<bool> chained{false};
+  NativeLimit();
+  ~NativeLimit();
+};
+
+static char *const INTERRUPTED = reinterpret_cast<char *>(~uintptr_t(0));
+static std::mutex limits_lock;
+static std::vector<NativeLimit *> limits; // one per thread that ran native code
+static thread_local NativeLimit native_limit;
+
+NativeLimit::NativeLimit()
+{
+  std::lock_guard<std::mutex> guard(limits_lock);
+  limits.push_back(this);
+}
+
+NativeLimit::~NativeLimit()
+{
+  std::lock_guard<std::mutex> guard(limits_lock);
+  limits.erase(std::find(limits.begin(), limits.end(), this));
+}
+
+void jitInterrupt(void)
+{
+  std::lock_guard<std::mutex> guard(limits_lock);
+  for (NativeLimit *l : limits)
+    if (l->chained) l->floor = INTERRUPTED;
+}
+
+// jitEscape: the runtime half of a failed check in compiled code. Native
+// frames hold nothing to destroy, so it jumps straight back to the call.
+//
+// int why: a JitEscape, plus the division's index for Division
+
+[[noreturn]] static void jitEscape(int why)
+{
+  escaped = why;
+  std::longjmp(*escape, 1);
+}
+
+// JitTyper: unification over the int/bool/unit types of a function group
+
+class JitTyper {
+    public:
+  int fresh(void)
+  {
+    parent.push_back(parent.size());
+    bound.push_back(-1);
+    return parent.size() - 1;
+  }
+  int fresh(JitType t)
+  {
+    int v = fresh();
+    bound[v] = static_cast<int>(t);
+    return v;
+  }
+  int find(int v)
+  {
+    while (parent[v] != v)
+      v = parent[v] = parent[parent[v]];
+    return v;
+  }
+  void unify(int a, int b, string where)
+  {
+    a = find(a);
+    b = find(b);
+    if (a == b) return;
+    if (bound[a] >= 0 && bound[b] >= 0 && bound[a] != bound[b])
+      throw JitUnsupported("type clash at " + where);
+    if (bound[a] < 0) bound[a] = bound[b];
+    parent[b] = a;
+  }
+  // unconstrained variables never reach a primitive, so any type will do
+  JitType resolve(int v)
+  {
+    int b = bound[find(v)];
+    return b < 0 ? JitType::Int : static_cast<JitType>(b);
+  }
+
+    private:
+  vector<int> parent;
+  vector<int> bound;
+};
+
+// JitCompiler: types a function group and lowers it to x86-64
+//
+// Values live in eax (bools are 0/1, unit is 0), the single parameter is
+// spilled to [rbp-8] and intermediate results are pushed on the machine
+// stack, so the code is a direct template expansion of the AST.
+
+class JitCompiler {
+    public:
+  JitCompiler(std::vector<std::shared_ptr<AstBranch>> const &funs_)
+      : funs(funs_)
+  {
+    for (auto fun : funs) {
+      names.push_back(name(fun->get(0)));
+      vars.push_back(name(fun->get(1)));
+      param_t.push_back(types.fresh());
+      result_t.push_back(types.fresh());
+    }
+  }
+
+  void check(void)
+  {
+    for (int i = 0; i < funs.size(); i++)
+      types.unify(result_t[i], infer(funs[i]->get(2), i), funs[i]->where());
+  }
+
+  // emit: Assembles the group after the entry code at offset 0, which calls
+  // function rdx with argument edi and rsi, where the stack floor is kept, in
+  // r12. Every function checks rsp against [r12] on the way in.
+  //
+  // return std::vector<size_t>: where each function starts
+  std::vector<size_t> emit(void)
+  {
+    bytes({0x41, 0x54, 0x49, 0x89, 0xF4}); // push r12; mov r12, rsi
+    bytes({0xFF, 0xD2, 0x41, 0x5C, 0xC3}); // call rdx; pop r12; ret
+    size_t stack = escapeTo(Stack);
+    std::vector<size_t> offsets;
+    for (int i = 0; i < funs.size(); i++) {
+      offsets.push_back(buf.size());
+      bytes({0x55, 0x48, 0x89, 0xE5});       // push rbp; mov rbp, rsp
+      bytes({0x48, 0x83, 0xEC, 0x10});       // sub rsp, 16
+      bytes({0x89, 0x7D, 0xF8});             // mov [rbp-8], edi
+      bytes({0x49, 0x3B, 0x24, 0x24});       // cmp rsp, [r12]
+      bytes({0x0F, 0x82});                   // jb
+      patch(hole(), stack);
+      gen(funs[i]->get(2), i, 0);
+      bytes({0xC9, 0xC3});                   // leave; ret
+    }
+    for (auto &call : calls)
+      patch(call.first, offsets[call.second]);
+    for (int k = 0; k < divisions.size(); k++)
+      patch(division_checks[k], escapeTo(Division + k));
+    return offsets;
+  }
+
+  JitType param(int i) { return types.resolve(param_t[i]); }
+  JitType result(int i) { return types.resolve(result_t[i]); }
+  std::vector<uint8_t> buf;
+  std::vector<string> divisions; // where each division is, in the source
+
+    private:
+  std::vector<std::shared_ptr<AstBranch>> const &funs;
+  std::vector<string> names;
+  std::vector<string> vars;
+  std::vector<int> param_t;
+  std::vector<int> result_t;
+  std::vector<std::pair<size_t, int>> calls; // rel32 site, callee index
+  std::vector<size_t> division_checks;       // rel32 site of each jz
+  std::map<AstNode *, int> print_t;
+  JitTyper types;
+
+  static string name(std::shared_ptr<AstNode> n)
+  {
+    return std::dynamic_pointer_cast<AstString>(n)->get_string();
+  }
+
+  // the group function a name refers to inside function fn, or -1
+  int callee(string x, int fn)
+  {
+    if (x == vars[fn]) return -1;
+    for (int i = names.size() - 1; i >= 0; i--) // the last one bound wins
+      if (names[i] == x) return i;
+    return -1;
+  }
+
+  int infer(std::shared_ptr<AstNode> node, int fn)
+  {
+    if (node->is_leaf()) {
+      if (node->label() == Label::Int) return types.fresh(JitType::Int);
+      if (node->label() == Label::Bool) return types.fresh(JitType::Bool);
+      if (node->label() == Label::Unit) return types.fresh(JitType::Unit);
+      throw JitUnsupported("literal " + node->string_label());
+    }
+    if (!node->is_branch()) throw JitUnsupported("raw node");
+    std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(node);
+    string where = ast->where();
+    int t;
+    switch (ast->label()) {
+    case Label::Literal:
+      return infer(ast->get(0), fn);
+    case Label::If:
+      types.unify(infer(ast->get(0), fn), types.fresh(JitType::Bool), where);
+      t = infer(ast->get(1), fn);
+      types.unify(t, infer(ast->get(2), fn), where);
+      return t;
+    case Label::Plus:
+    case Label::Minus:
+    case Label::Times:
+    case Label::Div:
+    case Label::Mod:
+    case Label::Less:
+    case Label::Equals:
+      t = types.fresh(JitType::Int);
+      types.unify(infer(ast->get(0), fn), t, where);
+      types.unify(infer(ast->get(1), fn), t, where);
+      if (ast->label() == Label::Less || ast->label() == Label::Equals)
+        return types.fresh(JitType::Bool);
+      return t;
+    case Label::And:
+    case Label::Or:
+      t = types.fresh(JitType::Bool);
+      types.unify(infer(ast->get(0), fn), t, where);
+      types.unify(infer(ast->get(1), fn), t, where);
+      return t;
+    case Label::Not:
+      t = types.fresh(JitType::Bool);
+      types.unify(infer(ast->get(0), fn), t, where);
+      return t;
+    case Label::Var:
+      if (name(ast->get(0)) != vars[fn])
+        throw JitUnsupported("free or first-class variable at " + where);
+      return param_t[fn];
+    case Label::App: {
+      std::shared_ptr<AstNode> f = ast->get(0);
+      if (f->label() != Label::Var) throw JitUnsupported("call at " + where);
+      int g = callee(name(std::dynamic_pointer_cast<AstBranch>(f)->get(0)), fn);
+      if (g < 0) throw JitUnsupported("unknown callee at " + where);
+      types.unify(infer(ast->get(1), fn), param_t[g], where);
+      return result_t[g];
+    }
+    case Label::Seq:
+      for (int i = 0; i + 1 < ast->count(); i++)
+        infer(ast->get(i), fn);
+      return infer(ast->get(ast->count() - 1), fn);
+    case Label::Print:
+      print_t[ast.get()] = infer(ast->get(0), fn);
+      return types.fresh(JitType::Unit);
+    default:
+      throw JitUnsupported(ast->string_label() + " at " + where);
+    }
+  }
+
+  void bytes(std::initializer_list<uint8_t> bs)
+  {
+    buf.insert(buf.end(), bs.begin(), bs.end());
+  }
+  void imm32(int32_t v)
+  {
+    for (int i = 0; i < 4; i++)
+      buf.push_back((v >> (8 * i)) & 0xFF);
+  }
+  void imm64(uint64_t v)
+  {
+    for (int i = 0; i < 8; i++)
+      buf.push_back((v >> (8 * i)) & 0xFF);
+  }
+  // emits a rel32 placeholder, returning its offset
+  size_t hole(void)
+  {
+    imm32(0);
+    return buf.size() - 4;
+  }
+  void patch(size_t at, size_t target)
+  {
+    int32_t rel = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(&buf[at], &rel, 4);
+  }
+  // escapeTo: Emits a call to jitEscape(why) for checks to jump to
+  //
+  // return size_t: its offset
+  size_t escapeTo(int why)
+  {
+    size_t at = buf.size();
+    bytes({0xBF}); // mov edi, imm32
+    imm32(why);
+    bytes({0x48, 0x83, 0xE4, 0xF0, 0x48, 0xB8}); // and rsp, -16; mov rax, imm64
+    imm64(reinterpret_cast<uint64_t>(&jitEscape));
+    bytes({0xFF, 0xD0}); // call rax
+    return at;
+  }
+  // keep rsp 16-byte aligned across calls given `depth` pending pushes
+  void alignCall(int depth, bool before)
+  {
+    if (depth % 2) bytes({0x48, 0x83, uint8_t(before ? 0xEC : 0xC4), 0x08});
+  }
+
+  void binary(std::shared_ptr<AstBranch> ast, int fn, int depth)
+  {
+    gen(ast->get(0), fn, depth);
+    bytes({0x50}); // push rax
+    gen(ast->get(1), fn, depth + 1);
+    bytes({0x89, 0xC1, 0x58}); // mov ecx, eax; pop rax
+  }
+
+  void gen(std::shared_ptr<AstNode> node, int fn, int depth)
+  {
+    if (node->is_leaf()) {
+      bytes({0xB8}); // mov eax, imm32
+      imm32(std::dynamic_pointer_cast<AstLeaf>(node)->val());
+      return;
+    }
+    std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(node);
+    size_t skip, done;
+    switch (ast->label()) {
+    case Label::Literal:
+      gen(ast->get(0), fn, depth);
+      break;
+    case Label::If:
+      gen(ast->get(0), fn, depth);
+      bytes({0x85, 0xC0, 0x0F, 0x84}); // test eax, eax; je
+      skip = hole();
+      gen(ast->get(1), fn, depth);
+      bytes({0xE9}); // jmp
+      done = hole();
+      patch(skip, buf.size());
+      gen(ast->get(2), fn, depth);
+      patch(done, buf.size());
+      break;
+    case Label::And:
+    case Label::Or:
+      gen(ast->get(0), fn, depth);
+      // test eax, eax; je/jne past the right operand with eax already 0/1
+      bytes({0x85, 0xC0, 0x0F,
+             uint8_t(ast->label() == Label::And ? 0x84 : 0x85)});
+      skip = hole();
+      gen(ast->get(1), fn, depth);
+      patch(skip, buf.size());
+      break;
+    case Label::Not:
+      gen(ast->get(0), fn, depth);
+      bytes({0x83, 0xF0, 0x01}); // xor eax, 1
+      break;
+    case Label::Plus:
+      binary(ast, fn, depth);
+      bytes({0x01, 0xC8}); // add eax, ecx
+      break;
+    case Label::Minus:
+      binary(ast, fn, depth);
+      bytes({0x29, 0xC8}); // sub eax, ecx
+      break;
+    case Label::Times:
+      binary(ast, fn, depth);
+      bytes({0x0F, 0xAF, 0xC1}); // imul eax, ecx
+      break;
+    case Label::Div:
+    case Label::Mod:
+      // idiv traps on a zero divisor and on the least int over -1, which
+      // wraps here as it does in eval
+      binary(ast, fn, depth);
+      bytes({0x85, 0xC9, 0x0F, 0x84}); // test ecx, ecx; jz
+      division_checks.push_back(hole());
+      divisions.push_back(ast->where());
+      bytes({0x83, 0xF9, 0xFF, 0x75, 0x04}); // cmp ecx, -1; jne +4
+      if (ast->label() == Label::Div) {
+        bytes({0xF7, 0xD8, 0xEB, 0x03}); // neg eax; jmp +3
+        bytes({0x99, 0xF7, 0xF9});       // cdq; idiv ecx
+      }
+      else {
+        bytes({0x31, 0xC0, 0xEB, 0x05}); // xor eax, eax; jmp +5
+        bytes({0x99, 0xF7, 0xF9, 0x89, 0xD0}); // cdq; idiv ecx; mov eax, edx
+      }
+      break;
+    case Label::Less:
+    case Label::Equals:
+      binary(ast, fn, depth);
+      // cmp eax, ecx; setl/sete al; movzx eax, al
+      bytes({0x39, 0xC8, 0x0F,
+             uint8_t(ast->label() == Label::Less ? 0x9C : 0x94), 0xC0, 0x0F,
+             0xB6, 0xC0});
+      break;
+    case Label::Var:
+      bytes({0x8B, 0x45, 0xF8}); // mov eax, [rbp-8]
+      break;
+    case Label::App:
+      gen(ast->get(1), fn, depth);
+      bytes({0x89, 0xC7}); // mov edi, eax
+      alignCall(depth, true);
+      bytes({0xE8}); // call rel32
+      calls.push_back(
+          {hole(),
+           callee(name(std::dynamic_pointer_cast<AstBranch>(ast->get(0))
+                           ->get(0)),
+                  fn)});
+      alignCall(depth, false);
+      break;
+    case Label::Seq:
+      for (int i = 0; i < ast->count(); i++)
+        gen(ast->get(i), fn, depth);
+      break;
+    case Label::Print:
+      gen(ast->get(0), fn, depth);
+      bytes({0x89, 0xC7, 0xBE}); // mov edi, eax; mov esi, imm32
+      imm32(static_cast<int>(types.resolve(print_t[ast.get()])));
+      alignCall(depth, true);
+      bytes({0x48, 0xB8}); // mov rax, imm64
+      imm64(reinterpret_cast<uint64_t>(&jitPrint));
+      bytes({0xFF, 0xD0}); // call rax
+      alignCall(depth, false);
+      bytes({0x31, 0xC0}); // xor eax, eax
+      break;
+    default:
+      throw JitUnsupported(ast->string_label());
+    }
+  }
+};
+
+std::shared_ptr<JitGroup> JitGroup::New(std::shared_ptr<AstBranch> decl)
+{
+  return std::shared_ptr<JitGroup>(new JitGroup(decl));
+}
+
+// JitGroup::JitGroup: Collects the Fun nodes of a declaration, in order
+//
+// std::shared_ptr<AstBranch> decl: a Fun or Funs node
+
+JitGroup::JitGroup(std::shared_ptr<AstBranch> decl_)
+{
+  decl = decl_;
+  if (decl_->label() != Label::Funs)
+    funs.push_back(decl_);
+  else
+    for (int i = 0; i < decl_->count(); i++)
+      funs.push_back(std::static_pointer_cast<AstBranch>(decl_->get(i)));
+}
+
+JitGroup::~JitGroup()
+{
+#if SML_JIT_SUPPORTED
+  if (code) munmap(code, code_size);
+#endif
+}
+
+// JitGroup::compile: Types and assembles every function in the group into
+// one block of executable memory
+//
+// return bool: false when the group is outside the supported subset
+
+bool JitGroup::compile(void)
+{
+#if SML_JIT_SUPPORTED
+  JitCompiler jc(funs);
+  std::vector<size_t> offsets;
+  try {
+    jc.check();
+    offsets = jc.emit();
+  }
+  catch (JitUnsupported const &) {
+    return false;
+  }
+  size_t page = sysconf(_SC_PAGESIZE);
+  code_size = (jc.buf.size() + page - 1) / page * page;
+  void *mem = mmap(nullptr, code_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return false;
+  std::memcpy(mem, jc.buf.data(), jc.buf.size());
+  if (mprotect(mem, code_size, PROT_READ | PROT_EXEC)) {
+    munmap(mem, code_size);
+    return false;
+  }
+  code = mem;
+  divisions = jc.divisions;
+  enter =
+      reinterpret_cast<int (*)(int, std::atomic<char *> *, int (*)(int))>(code);
+  for (int i = 0; i < funs.size(); i++) {
+    params.push_back(jc.param(i));
+    results.push_back(jc.result(i));
+    entries.push_back(reinterpret_cast<int (*)(int)>(
+        static_cast<uint8_t *>(code) + offsets[i]));
+  }
+  offsets.push_back(jc.buf.size());
+  if (JIT.perf_map) writePerfMap(offsets);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// JitGroup::writePerfMap: Appends the group's symbols to the map file `perf`
+// reads for JIT code
+//
+// std::vector<size_t> offsets: function starts, then the end of the code
+
+void JitGroup::writePerfMap(std::vector<size_t> const &offsets)
+{
+  string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  FILE *map = fopen(path.c_str(), "a");
+  if (!map) return;
+  for (int i = 0; i < funs.size(); i++)
+    fprintf(map, "%lx %lx sml::%s\n",
+            reinterpret_cast<unsigned long>(entries[i]),
+            static_cast<unsigned long>(offsets[i + 1] - offsets[i]),
+            std::dynamic_pointer_cast<AstString>(funs[i]->get(0))
+                ->get_string()
+                .c_str());
+  fclose(map);
+}
+
+// JitGroup::call: Runs a closure's native code once the group is compiled
+//
+// SMLClos &c: the closure being applied
+// std::shared_ptr<SMLValue> x: the argument
+//
+// return std::shared_ptr<SMLValue>: the result, or nullptr to make the
+// caller interpret the body
+
+std::shared_ptr<SMLValue> JitGroup::call(SMLClos &c,
+                                         std::shared_ptr<SMLValue> x)
+{
+  State s = state.load(std::memory_order_acquire);
+  if (s == State::Waiting) {
+    if (!JIT.enabled || ++calls < JIT.threshold) return nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    if (state == State::Waiting)
+      state.store(compile() ? State::Compiled : State::Failed,
+                  std::memory_order_release);
+    s = state;
+  }
+  // native code never polls, so it could outrun an evaluation's deadline
+  // and limits
+  if (s != State::Compiled || context().bounded()) return nullptr;
+
+  int i = c.jit_index;
+  int arg;
+  if (params[i] == JitType::Int && x->type() == "Int")
+    arg = *std::dynamic_pointer_cast<SMLInt>(x);
+  else if (params[i] == JitType::Bool && x->type() == "Bool")
+    arg = *SMLBool::New(x);
+  else if (params[i] == JitType::Unit && x->type() == "Unit")
+    arg = 0;
+  else
+    return nullptr;
+
+  if (inParallel()) {
+    native_limit.chained = true;
+    native_limit.floor = stackFloor();
+    if (parallelCancelled()) return nullptr; // a poll throws soon enough
+  }
+  else if (native_limit.chained) {
+    std::lock_guard<std::mutex> guard(limits_lock);
+    native_limit.chained = false;
+    native_limit.floor = stackFloor();
+  }
+  else
+    native_limit.floor = stackFloor();
+
+  std::jmp_buf here;
+  std::jmp_buf *outer = escape;
+  escape = &here;
+  if (setjmp(here)) {
+    escape = outer;
+    if (escaped == Stack && native_limit.floor == INTERRUPTED) {
+      native_limit.floor = stackFloor();
+      return nullptr; // pure, as halves of pairs are, so it can start over
+    }
+    if (escaped == Stack)
+      throw LimitExceeded("Stack exhausted (" + context().usage().to_string() +
+                          ")");
+    throw RunTimeError("Division by zero at " + divisions[escaped - Division] +
+                       ".");
+  }
+  int r = enter(arg, &native_limit.floor, entries[i]);
+  escape = outer;
+  if (results[i] == JitType::Int) return SMLInt::New(r);
+  if (results[i] == JitType::Bool) return SMLBool::New(r != 0);
+  return SMLUnit::New();
+}
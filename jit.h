@@ -0,0 +1,60 @@
+#pragma once
+#include "eval.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Calls into a `fun` group before it is handed to the native compiler
+const int JIT_THRESHOLD = 100;
+
+struct JitOptions {
+  bool enabled{true};
+  int threshold{JIT_THRESHOLD};
+  bool perf_map{false}; // append symbols to /tmp/perf-<pid>.map
+};
+
+extern JitOptions JIT;
+
+enum class JitType { Int, Bool, Unit };
+
+// jitInterrupt: Makes native code running half of a parallel pair give up
+// at its next call, which has its caller interpret the rest, so that a
+// cancelled pair stops at a poll (parallel.h). Code outside pairs, which may
+// print, is left to finish.
+void jitInterrupt(void);
+
+// JitGroup: native x86-64 code for one `fun ... and ...` declaration. The
+// group is shared by every closure built from the declaration, counts calls
+// into it and compiles all of its functions together once the count passes
+// JIT.threshold. Anything outside the int/bool subset leaves the group to the
+// tree walker. Compiled functions check the stack on entry and divisors for
+// zero, and stop with the errors eval would give; they never poll, so a context with a
+// deadline or limits keeps interpreting them.
+class JitGroup {
+    public:
+  static std::shared_ptr<JitGroup> New(std::shared_ptr<AstBranch> decl);
+  ~JitGroup();
+  std::shared_ptr<AstBranch> declaration(void) { return decl.lock(); }
+  std::shared_ptr<SMLValue> call(SMLClos &c, std::shared_ptr<SMLValue> x);
+  bool compiled(void) { return state == State::Compiled; }
+
+    protected:
+  JitGroup(std::shared_ptr<AstBranch> decl);
+  enum class State { Waiting, Compiled, Failed };
+  bool compile(void);
+  void writePerfMap(std::vector<size_t> const &offsets);
+
+  std::atomic<State> state{State::Waiting};
+  std::atomic<int> calls{0};
+  std::mutex lock; // guards compilation
+  std::weak_ptr<AstBranch> decl; // which owns the group
+  std::vector<std::shared_ptr<AstBranch>> funs; // in closure creation order
+  std::vector<JitType> params;
+  std::vector<JitType> results;
+  std::vector<int (*)(int)> entries;
+  std::vector<std::string> divisions; // where each one is, for its error
+  int (*enter)(int, std::atomic<char *> *, int (*)(int)){
+      nullptr}; // see JitCompiler::emit
+  void *code{nullptr};
+  size_t code_size{0};
+};
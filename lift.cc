@@ -0,0 +1,168 @@
+#include "lift.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+
+static std::shared_ptr<AstBranch> branch(std::shared_ptr<AstNode> n)
+{
+  return n->is_branch() ? std::static_pointer_cast<AstBranch>(n) : nullptr;
+}
+
+static std::string text(std::shared_ptr<AstNode> n)
+{
+  return std::static_pointer_cast<AstString>(n)->get_string();
+}
+
+// declared: the names a Val, Fun or Funs node declares
+static std::vector<std::string> declared(std::shared_ptr<AstBranch> d)
+{
+  if (d->label() != Label::Funs) return {text(d->get(0))};
+  std::vector<std::string> out;
+  for (int i = 0; i < d->count(); i++)
+    out.push_back(text(branch(d->get(i))->get(0)));
+  return out;
+}
+
+// binds: the names a node binds in its child i
+static std::vector<std::string> binds(std::shared_ptr<AstBranch> ast, int i)
+{
+  switch (ast->label()) {
+  case Label::Lam:
+    return {text(ast->get(0))};
+  case Label::Fun:
+    return {text(ast->get(0)), text(ast->get(1))};
+  case Label::Funs:
+    return declared(ast);
+  case Label::Let:
+    return i == 1 ? declared(branch(ast->get(0))) : std::vector<std::string>{};
+  default:
+    return {};
+  }
+}
+
+// freeVars: Collects the variables a tree uses but does not bind
+static void freeVars(std::shared_ptr<AstNode> node,
+                     std::vector<std::string> &bound,
+                     std::set<std::string> &out)
+{
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast) return;
+  if (ast->label() == Label::Var) {
+    std::string x = text(ast->get(0));
+    if (std::find(bound.begin(), bound.end(), x) == bound.end()) out.insert(x);
+    return;
+  }
+  for (int i = 0; i < ast->count(); i++) {
+    std::vector<std::string> b = binds(ast, i);
+    bound.insert(bound.end(), b.begin(), b.end());
+    freeVars(ast->get(i), bound, out);
+    bound.resize(bound.size() - b.size());
+  }
+}
+
+// rename: Renames the uses of some variables in a tree, except where a
+// binding inside it hides them
+static void rename(std::shared_ptr<AstNode> node,
+                   std::map<std::string, std::string> const &to)
+{
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast || to.empty()) return;
+  if (ast->label() == Label::Var) {
+    auto found = to.find(text(ast->get(0)));
+    if (found != to.end()) ast->set(0, AstString::New(found->second));
+    return;
+  }
+  for (int i = 0; i < ast->count(); i++) {
+    std::vector<std::string> b = binds(ast, i);
+    if (b.empty()) {
+      rename(ast->get(i), to);
+      continue;
+    }
+    std::map<std::string, std::string> visible = to;
+    for (std::string &x : b)
+      visible.erase(x);
+    rename(ast->get(i), visible);
+  }
+}
+
+// Lifter: one top-level item at a time, with the names bound around each
+// node on the way down
+class Lifter {
+    public:
+  std::shared_ptr<AstNode> rewrite(std::shared_ptr<AstNode> node);
+  std::vector<std::shared_ptr<AstBranch>> lifted; // to declare before the item
+
+    private:
+  bool closed(std::shared_ptr<AstBranch> decl);
+  std::vector<std::string> scope; // innermost last
+};
+
+// Lifter::closed: whether a declaration uses none of the names in scope
+bool Lifter::closed(std::shared_ptr<AstBranch> decl)
+{
+  std::vector<std::string> bound;
+  std::set<std::string> free;
+  freeVars(decl, bound, free);
+  for (std::string const &x : free)
+    if (std::find(scope.begin(), scope.end(), x) != scope.end()) return false;
+  return true;
+}
+
+// Lifter::rewrite: Lifts the closed `let fun`s in a tree, innermost first,
+// so an outer function that only used inner ones is closed in turn
+//
+// return std::shared_ptr<AstNode>: what replaces it
+std::shared_ptr<AstNode> Lifter::rewrite(std::shared_ptr<AstNode> node)
+{
+  static std::atomic<int> lifts{0}; // numbers names across a session
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast) return node;
+  for (int i = 0; i < ast->count(); i++) {
+    std::vector<std::string> b = binds(ast, i);
+    scope.insert(scope.end(), b.begin(), b.end());
+    ast->set(i, rewrite(ast->get(i)));
+    scope.resize(scope.size() - b.size());
+  }
+  if (ast->label() != Label::Let) return ast;
+  std::shared_ptr<AstBranch> d = branch(ast->get(0));
+  if (d->label() == Label::Val || !closed(d)) return ast;
+
+  // `#` never appears in a name the lexer reads
+  std::map<std::string, std::string> to;
+  for (std::string &f : declared(d))
+    to[f] = f + "#" + std::to_string(++lifts);
+  std::vector<std::shared_ptr<AstBranch>> funs;
+  if (d->label() == Label::Fun)
+    funs.push_back(d);
+  else
+    for (int i = 0; i < d->count(); i++)
+      funs.push_back(branch(d->get(i)));
+  for (std::shared_ptr<AstBranch> &fun : funs) {
+    std::map<std::string, std::string> visible = to;
+    visible.erase(text(fun->get(1))); // the parameter
+    fun->set(0, AstString::New(to[text(fun->get(0))]));
+    rename(fun->get(2), visible);
+  }
+  rename(ast->get(1), to);
+  lifted.push_back(d);
+  return ast->get(1);
+}
+
+std::shared_ptr<AstBranch> liftFunctions(std::shared_ptr<AstBranch> program)
+{
+  Lifter pass;
+  std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
+  out->label(Label::Program);
+  out->where(program->where());
+  bool any = false;
+  for (int k = 0; k < program->count(); k++) {
+    std::shared_ptr<AstNode> item = pass.rewrite(program->get(k));
+    for (std::shared_ptr<AstBranch> &d : pass.lifted)
+      out->add(d);
+    any = any || pass.lifted.size();
+    pass.lifted.clear();
+    out->add(item);
+  }
+  return any ? out : program;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "parser.h"
+
+// liftFunctions: Moves every `let fun` whose functions use no variable bound
+// around the let (only their parameters, each other and top-level names) to
+// the top level of the program. The group is declared just before the item
+// it came from, under names no program can write, and the let is replaced by
+// its body, so a helper defined inside a function is built once rather than
+// on every call, and may be compiled by the JIT like any top-level function.
+//
+// Functions that use locals stay where they are. Passing those as extra
+// parameters would cost a tuple per call, as a function takes one argument,
+// against one closure per evaluation of the let.
+//
+// std::shared_ptr<AstBranch> program: a Program node
+//
+// return std::shared_ptr<AstBranch>: the program with the lifted groups
+std::shared_ptr<AstBranch> liftFunctions(std::shared_ptr<AstBranch> program);
@@ -1,5 +1,31 @@
+#include "astcache.h"
+#include "builtin.h"
+#include "emitcpp.h"
+#include "escape.h"
 #include "eval.h"
+#include "image.h"
+#include "incremental.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "lift.h"
+#include "module.h"
+#include "parallel.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 
 void runTest(std::string const &entry, std::string const &result, int &testNum,
              int &tests_not_implemented, int &tests_passed)
@@ -9,8 +35,10 @@ void runTest(std::string const &entry, std::string const &result, int &testNum,
   try {
     InputStream i{entry};
     TokenStream t = TokenStream("", &i);
-    std::shared_ptr<AstBranch> ast = SMLParser(&t)();
+    std::shared_ptr<AstNode> ast = analyzeEscapes(SMLParser(&t)());
+    planParallel(ast);
     std::shared_ptr<SMLValue> out = eval(ast);
+    context().out.flush(); // what it printed, before the verdict
 
     if (out->to_string() == result) {
       std::cout << " => " << result << ": passed.";
@@ -30,6 +58,29 @@ void runTest(std::string const &entry, std::string const &result, int &testNum,
   }
 }
 
+struct CorpusOptions {
+  double timeout{10}; // seconds per file
+  bool junit{false};  // JUnit XML instead of TAP
+};
+
+int runCorpus(std::string dir, CorpusOptions opts);
+
+// runCheck: Reports a test that computed its own outcome, for what a single
+// expression cannot show
+void runCheck(std::string const &name, bool ok, std::string const &expected,
+              std::string const &got, int &testNum, int &tests_passed)
+{
+  testNum++;
+  std::cout << "\nTEST NO" << testNum << ": " << name;
+  if (ok) {
+    std::cout << " => " << expected << ": passed.";
+    tests_passed++;
+  }
+  else
+    std::cout << " => failed:\n\tExpected: " << expected << "\n\tGot: " << got
+              << "\n";
+}
+
 int unitTestAll(void)
 {
   std::cout << "Running unit test on SML interpreter";
@@ -40,6 +91,10 @@ int unitTestAll(void)
                                                                string o) {
     runTest(i, o, test_no, test_not_implemented, tests_passed);
   };
+  auto check = [&tests_passed, &test_no](string name, bool ok, string expected,
+                                         string got) {
+    runCheck(name, ok, expected, got, test_no, tests_passed);
+  };
 
   test("5", "5");                                                   // 1
   test("5+1", "6");                                                 // 2
@@ -76,6 +131,343 @@ int unitTestAll(void)
   test("let fun fib x = if x=0 then 0 else if x=1 then 1 else (fib (x-1))+(fib "
        "(x-2)) in (fib 10) end",
        "55"); // 28
+  test("let fun ev x = if x=0 then true else od (x-1) and od y = if y=0 "
+       "then false else ev (y-1) in (ev 300, od 301) end",
+       "(true,true)"); // 29
+  test("let fun fib x = if x<2 then x else (fib (x-1))+(fib (x-2)) in (fib "
+       "20) end",
+       "6765"); // 30
+  test("let val k=3 in let fun f x = if x=0 then 0 else k+(f (x-1)) in f "
+       "200 end end",
+       "600"); // 31
+  test("let fun f x = if x=0 then 0 else 1+(f (x-1)) in let val g = f in g "
+       "150 end end",
+       "150"); // 32
+  test("let fun pfib n = if n<2 then (n,n) else let val p = (pfib (n-1), pfib "
+       "(n-2)) in (fst (fst p)+fst (snd p), n) end in fst (pfib 16) end",
+       "987"); // 33
+  test("let fun f x = if x=0 then (fst (1,2) = 3) else f (x-1) in (f 50, "
+       "not (f 60)) end",
+       "(false,true)"); // 34
+  test("let val x=1 in let val x=x+1 in x end end", "2");            // 35
+  test("let val n=1 in let fun f n = if n=0 then 0 else 1+(f (n-1)) in f "
+       "200 end end",
+       "200"); // 36
+  test("let val p=(1,2) in let val p=(3,fst p) in (fst p)*10+snd p end end",
+       "31"); // 37
+  test("let val f = fn x=> (print x, x+1) in snd (f 4) end", "5"); // 38
+  test("let fun h f = f 1 in (h (fn x=> x < 2), h (fn y=> y+1)) end",
+       "(true,2)"); // 39
+  test("let val t = (1, (2,3), 4) in #3 t + #2 (#2 t) end", "7"); // 40
+  test("(#1 (1,2), (fst (3,4), 5, 6))", "(1,(3,5,6))");           // 41
+  test("let val k = 3 in Vector.map (fn x => x * k - 1, [1,2,3]) end",
+       "[2,5,8]"); // 42
+  test("Vector.foldl (fn p => fst p * 2 + snd p, 0, Vector.filter (fn x => "
+       "not (x < 3), Vector.tabulate (1000, fn i => i mod 7)))",
+       "5136"); // 43
+  test("let val s = \"hello\" ^ \", \" ^ \"world\" in (String.size s, "
+       "String.substring (s, 7, 5) = \"world\") end",
+       "(12,true)"); // 44
+  test("String.sub (\"abc\", 1) + String.size (\"x\" ^ String.str 65)",
+       "100"); // 45
+  test("let fun add x = fn y => fn z => x+y*z in let val inc = add 1 1 in "
+       "(inc 2, add 3 4 5, (add 1) 2 3) end end",
+       "(3,23,7)"); // 46
+  {
+    // a recursive closure outlives its let only as a cycle, until collected
+    EvalContext ctx;
+    ContextScope scope(&ctx);
+    test("let fun f x = if x=0 then 0 else f (x-1) and g y = f y in g 3 end",
+         "0"); // 47
+    size_t freed = ctx.gc.collect();
+    check("collect", freed == 2 && ctx.gc.tracked() == 0, "2",
+          std::to_string(freed));
+  }
+  {
+    // an edit inside one item reparses that item and keeps the others
+    std::string text = "val a = 1;\nval b = a + 2;\nfun f x = x * b;\nf 4";
+    IncrementalParser doc("edit", text);
+    std::shared_ptr<AstBranch> before = doc.program();
+    doc.edit(text.find("2;"), 1, "20;\nval c = 3");
+    std::shared_ptr<AstBranch> after = doc.program();
+    InputStream i{doc.text()};
+    TokenStream t("edit", &i);
+    check("incremental",
+          after->to_string() == SMLParser(&t).program()->to_string() &&
+              doc.reparsed() == 2 && after->get(0) == before->get(0) &&
+              after->get(3) == before->get(2),
+          "reused", std::to_string(doc.reparsed()) + " reparsed");
+  }
+  {
+    // a runaway call stops at its step limit, a large vector at its byte one
+    auto limited = [](std::string entry, Limits l) -> std::string {
+      EvalContext ctx;
+      ContextScope scope(&ctx);
+      ctx.start(l);
+      InputStream i{entry};
+      TokenStream t("", &i);
+      try {
+        eval(analyzeEscapes(SMLParser(&t)()));
+      }
+      catch (LimitExceeded err) {
+        return err.what().substr(0, err.what().find(' '));
+      }
+      return "none";
+    };
+    std::string got =
+        limited("let fun f x = f x in f 1 end", Limits{1000}) + "," +
+        limited("Vector.tabulate (100000, fn i => i)", Limits{0, 100000});
+    check("limits", got == "Step,Memory", "Step,Memory", got);
+  }
+  {
+    // a helper using nothing local moves to top level, one using n stays
+    InputStream i{"fun f n = let fun sq x = x * x in sq n end;\n"
+                  "fun g n = let fun add x = x + n in add 1 end"};
+    TokenStream t("lift", &i);
+    std::shared_ptr<AstBranch> prog = liftFunctions(SMLParser(&t).program());
+    std::string got =
+        std::to_string(prog->count()) + " " +
+        std::static_pointer_cast<AstString>(
+            std::static_pointer_cast<AstBranch>(prog->get(0))->get(0))
+            ->get_string()
+            .substr(0, 3);
+    check("lift", got == "3 sq#", "3 sq#", got);
+  }
+  {
+    // cached trees read back whole; a branch given the wrong number or kind
+    // of children is refused
+    InputStream i{"fun f x = let val y = #2 (x, x + 1, [1]) in (f, y) end;\n"
+                  "fun g x = x and h y = g (String.size \"ab\"); (print 1; 2)"};
+    TokenStream t("cache", &i);
+    std::vector<AstRecord> records;
+    std::string strings;
+    flattenAst(SMLParser(&t).program(), records, strings);
+    auto read = [&strings](std::vector<AstRecord> r) -> std::string {
+      try {
+        AstReader reader(r.data(), r.size(), strings.data(), strings.size());
+        reader.node();
+        return reader.done() ? "ok" : "short";
+      }
+      catch (std::out_of_range &) {
+        return "refused";
+      }
+    };
+    auto relabel = [&records](Label from, Label to) {
+      std::vector<AstRecord> r = records;
+      for (AstRecord &n : r)
+        if (n.label == from && n.kind == records[0].kind) {
+          n.label = to;
+          break;
+        }
+      return r;
+    };
+    std::string got = read(records) + "," +
+                      read(relabel(Label::App, Label::Not)) + "," +
+                      read(relabel(Label::Val, Label::Lam));
+    check("cache shape", got == "ok,refused,refused", "ok,refused,refused",
+          got);
+  }
+  {
+    // an image loads back to working closures; one whose AST has a branch
+    // with the wrong children is refused rather than run
+    std::string path =
+        (std::filesystem::temp_directory_path() /
+         ("miniml-image-" + std::to_string(getpid()) + ".img"))
+            .string();
+    auto run = [](std::string program, Session &session) -> std::string {
+      InputStream i{program};
+      std::shared_ptr<SMLValue> v =
+          interpret(TokenStream("image", &i), session);
+      return v ? v->to_string() : "";
+    };
+    Session saved;
+    saved.echo = false;
+    run("fun f x = if x = 0 then 0 else x + f (x - 1);\n"
+        "val g = fn y => f y * 2",
+        saved);
+    Session loaded;
+    loaded.echo = false;
+    bool wrote = saveImage(path, saved.env, saved.prints);
+    std::string got =
+        wrote && loadImage(path, loaded.env, loaded.prints)
+            ? run("g 4", loaded)
+            : "unloaded";
+    // the first App record, as flattenAst writes one, made a Not
+    InputStream i{"f 1"};
+    TokenStream t("image", &i);
+    std::vector<AstRecord> app;
+    std::string strings;
+    flattenAst(SMLParser(&t)(), app, strings);
+    std::fstream image(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(image)),
+                      std::istreambuf_iterator<char>());
+    size_t at =
+        bytes.find(std::string(reinterpret_cast<char *>(&app[0]), 8));
+    if (at != std::string::npos) {
+      image.seekp(at);
+      image.put(static_cast<char>(Label::Not));
+    }
+    image.close();
+    got += std::string(",") +
+           (loadImage(path, loaded.env, loaded.prints) ? "loaded" : "refused");
+    std::filesystem::remove(path);
+    check("image", got == "20,refused", "20,refused", got);
+  }
+  {
+    // interpreters on two threads each see only their own declarations
+    Interpreter a, b, c(Limits{1000});
+    Result ra, rb;
+    std::thread ta([&] {
+      a.evaluate("val x = 1");
+      ra = a.evaluate("print x; x + 10");
+    });
+    std::thread tb([&] {
+      b.evaluate("val x = 2");
+      rb = b.evaluate("x * 100");
+    });
+    ta.join();
+    tb.join();
+    Result rc = c.evaluate("let fun f x = f x in f 1 end");
+    std::string got = ra.to_string() + "," + ra.printed + rb.to_string() +
+                      "," + rc.error.substr(0, 4);
+    check("interpreters", got == "11,1\n200,Step", "11,1 200,Step", got);
+  }
+  {
+    // with default options, where hot functions run as native code, runaway
+    // recursion and division by zero are errors the instance survives
+    Interpreter in;
+    in.evaluate("fun deep x = if x = 0 then 0 else 1 + deep (x+1);\n"
+                "fun d x = if x = 0 then 100 div x else d (x-1)");
+    Result deep = in.evaluate("deep 1");
+    Result div = in.evaluate("d 500");
+    Result after = in.evaluate("d 0 + 1");
+    Result fine = in.evaluate("deep 0 + 1");
+    std::string got = deep.error.substr(0, 15) + "," + div.error.substr(0, 16) +
+                      "," + after.error.substr(0, 16) + "," + fine.to_string();
+    std::string expected =
+        "Stack exhausted,Division by zero,Division by zero,1";
+    check("interpreter errors", got == expected, expected, got);
+  }
+  {
+    // an embedded program cannot read host files through use, unless allowed
+    Interpreter in;
+    Result r = in.evaluate("use \"/etc/hostname\"; 1");
+    in.use_files = true;
+    Result allowed = in.evaluate("use \"/nonexistent.sml\"; 1");
+    std::string got = r.error.substr(0, 18) + "," + allowed.error.substr(0, 11);
+    check("interpreter use", got == "use is not allowed,Cannot read",
+          "use is not allowed,Cannot read", got);
+  }
+  {
+    // pairs are forked when both halves reach a recursive function, not when
+    // they only call cheap ones
+    InputStream i{"fun sq x = x * x;\n"
+                  "fun fib x = if x < 2 then x else fib (x - 1) + fib (x - 2);\n"
+                  "(sq 3, sq 4); (fib 20, fib 21); (fib 20, sq 4)"};
+    TokenStream t("plan", &i);
+    std::shared_ptr<AstBranch> prog = SMLParser(&t).program();
+    planParallel(prog);
+    std::string got;
+    for (int k = 2; k < prog->count(); k++)
+      got += std::static_pointer_cast<AstBranch>(prog->get(k))->fork() ? "1"
+                                                                       : "0";
+    check("plan", got == "010", "010", got);
+  }
+  {
+    // under --parallel the deep half of a pair may run on a worker, whose
+    // stack is checked like the evaluating thread's
+    ParallelOptions parallel = PARALLEL;
+    JitOptions jit = JIT;
+    PARALLEL.enabled = true;
+    if (!PARALLEL.workers) PARALLEL.workers = 4;
+    JIT.enabled = false;
+    Interpreter in;
+    Result r = in.evaluate(
+        "let fun f x = if x = 0 then 0 else 1 + f (x - 1)\n"
+        "and fib x = if x < 2 then x else fib (x - 1) + fib (x - 2)\n"
+        "in (f 10000000, fib 20) end");
+    PARALLEL = parallel;
+    JIT = jit;
+    std::string got = r.error.substr(0, 15);
+    check("parallel stack", got == "Stack exhausted", "Stack exhausted", got);
+  }
+  {
+    // a hot int function runs as native code, one making pairs falls back to
+    // eval; native recursion stops at the stack's end, and with a deadline
+    // set fib is interpreted, so it times out
+    auto jit = [](std::string program, double seconds) -> std::string {
+      EvalContext ctx;
+      ContextScope scope(&ctx);
+      Session session;
+      session.echo = false;
+      if (seconds > 0)
+        ctx.deadline = std::chrono::steady_clock::now() +
+                       std::chrono::duration_cast<
+                           std::chrono::steady_clock::duration>(
+                           std::chrono::duration<double>(seconds));
+      InputStream i{program};
+      TokenStream t("jit", &i);
+      std::shared_ptr<AstBranch> prog = SMLParser(&t).program();
+      try {
+        std::string got = interpret(prog, session)->to_string();
+        return (std::static_pointer_cast<AstBranch>(prog->get(0))
+                        ->jit()
+                        ->compiled()
+                    ? "native "
+                    : "eval ") +
+               got;
+      }
+      catch (Timeout err) {
+        return "Timeout";
+      }
+      catch (LimitExceeded err) {
+        return err.what().substr(0, err.what().find(' '));
+      }
+    };
+    std::string fib = "fun fib x = if x < 2 then x else fib (x-1) + fib (x-2)";
+    std::string got =
+        jit(fib + "; fib 20", 0) + "," +
+        jit("fun f x = if x = 0 then (0, 0) else f (x-1); f 200", 0) + "," +
+        jit("fun f x = if x = 0 then 0 else 1 + f (x+1); f 1", 0) + "," +
+        jit(fib + "; fib 32", 0.02);
+    std::string expected = "native 6765,eval (0,0),Stack,Timeout";
+    check("jit", got == expected, expected, got);
+  }
+  {
+    // in a corpus run, a file that times out, runs off the stack or makes
+    // the interpreter throw fails on its own, and the files after it still
+    // run
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+                                ("miniml-corpus-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "a-slow.sml")
+        << "fun f x = if x = 0 then 0 else f (x-1) + f (x-1); f 40\n";
+    std::ofstream(dir / "a-slow.out");
+    std::ofstream(dir / "b-deep.sml")
+        << "fun f x = if x = 0 then 0 else 1 + f (x+1); f 1\n";
+    std::ofstream(dir / "b-deep.out");
+    std::ofstream(dir / "c-fine.sml") << "fun f x = x + 1; f 2\n";
+    std::ofstream(dir / "c-fine.out") << "Out: [Int, 3]\n";
+    std::ofstream(dir / "d-huge.sml")
+        << "Vector.tabulate (2000000000, fn i => i)\n";
+    std::ofstream(dir / "d-huge.out");
+    std::ostringstream tap;
+    std::streambuf *saved = std::cout.rdbuf(tap.rdbuf());
+    int failed = runCorpus(dir.string(), CorpusOptions{0.2});
+    std::cout.rdbuf(saved);
+    std::filesystem::remove_all(dir);
+    std::string report = tap.str();
+    auto has = [&report](std::string s) {
+      return report.find(s) != std::string::npos;
+    };
+    std::string got = std::to_string(failed) + " failed" +
+                      (has("timed out") ? ", timed out" : "") +
+                      (has("Stack exhausted") ? ", stack" : "") +
+                      (has("\nok 3 - c-fine.sml") ? ", fine" : "") +
+                      (has("crashed: std::bad_alloc") ? ", crashed" : "");
+    std::string expected = "3 failed, timed out, stack, fine, crashed";
+    check("corpus", got == expected, expected, got);
+  }
   std::cout << "\n"
             << tests_passed << " passed! "
             << test_no - tests_passed - test_not_implemented << " failed! "
@@ -83,45 +475,506 @@ int unitTestAll(void)
   return test_no - tests_passed; // number of tests failed
 }
 
-std::shared_ptr<SMLValue> interpret(TokenStream tks)
+// reportError: Writes an error after whatever the program printed before it
+//
+// LexError &err: what was thrown
+
+static void reportError(LexError &err)
+{
+  Output &out = context().out;
+  out.write("\nError caught:\n");
+  out.write(err.what());
+  out.put('\n');
+}
+
+// CorpusResult: the outcome of one corpus file
+struct CorpusResult {
+  std::string name;
+  std::string expected;
+  std::string got;
+  bool has_expected{false};
+  bool timed_out{false};
+  std::string crashed; // what the interpreter itself threw, if anything
+  double seconds{0};
+  bool passed(void)
+  {
+    return has_expected && !timed_out && crashed.empty() && got == expected;
+  }
+};
+
+// runCorpusFile: Runs one program the way `MiniML file` would, in a context
+// of its own
+//
+// std::filesystem::path path: the .sml file
+// CorpusResult &r: where the output and timing go
+// CorpusOptions opts: the timeout
+
+static void runCorpusFile(std::filesystem::path path, CorpusResult &r,
+                          CorpusOptions opts)
+{
+  std::ostringstream out;
+  EvalContext ctx;
+  ctx.out.sink(&out);
+  auto start = std::chrono::steady_clock::now();
+  ctx.deadline = start + std::chrono::duration_cast<
+                             std::chrono::steady_clock::duration>(
+                             std::chrono::duration<double>(opts.timeout));
+  ContextScope scope(&ctx);
+  try {
+    // named as if run from the corpus directory, so expected output is too
+    interpret(loadProgram({{path.filename().string(), path}}));
+  }
+  catch (Timeout err) {
+    r.timed_out = true;
+  }
+  catch (LexError err) {
+    reportError(err);
+  }
+  catch (std::exception &err) { // not the program's doing, so a failure
+    r.crashed = err.what();
+  }
+  ctx.out.flush();
+  r.got = out.str();
+  r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+}
+
+static std::string xmlEscape(std::string s)
+{
+  std::string out;
+  for (char c : s) {
+    if (c == '<')
+      out += "&lt;";
+    else if (c == '>')
+      out += "&gt;";
+    else if (c == '&')
+      out += "&amp;";
+    else if (c == '"')
+      out += "&quot;";
+    else
+      out += c;
+  }
+  return out;
+}
+
+static std::string indent(std::string s, std::string pad)
+{
+  if (s.size() && s.back() == '\n') s.pop_back();
+  std::string out = pad;
+  for (int i = 0; i < s.size(); i++) {
+    out += s[i];
+    if (s[i] == '\n' && i + 1 < s.size()) out += pad;
+  }
+  return out;
+}
+
+static std::string failure(CorpusResult &r, CorpusOptions opts)
+{
+  if (!r.has_expected) return "no expected output";
+  if (r.timed_out) {
+    std::ostringstream msg;
+    msg << "timed out after " << opts.timeout << "s";
+    return msg.str();
+  }
+  if (r.crashed.size()) return "crashed: " + r.crashed;
+  return "output differs";
+}
+
+// runCorpus: Runs every .sml file in a directory against the .out file next
+// to it, sharding the files across threads
+//
+// std::string dir: the corpus directory
+// CorpusOptions opts: timeout and report format
+//
+// return int: the number of files that did not pass
+
+int runCorpus(std::string dir, CorpusOptions opts)
+{
+  std::vector<std::filesystem::path> files;
+  for (auto &entry : std::filesystem::directory_iterator(dir))
+    if (entry.path().extension() == ".sml") files.push_back(entry.path());
+  std::sort(files.begin(), files.end());
+
+  std::vector<CorpusResult> results(files.size());
+  for (int k = 0; k < files.size(); k++) {
+    std::filesystem::path expected = files[k];
+    expected.replace_extension(".out");
+    results[k].name = files[k].filename().string();
+    results[k].has_expected = std::filesystem::exists(expected);
+    if (results[k].has_expected) results[k].expected = readSource(expected);
+  }
+
+  std::atomic<int> next{0};
+  int shards = PARALLEL.workers > 0
+                   ? PARALLEL.workers
+                   : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (int t = 0; t < std::min<int>(shards, files.size()); t++)
+    threads.push_back(std::thread([&]() {
+      for (int k; (k = next++) < files.size();)
+        runCorpusFile(files[k], results[k], opts);
+    }));
+  for (std::thread &t : threads)
+    t.join();
+
+  int failed{0};
+  for (CorpusResult &r : results)
+    failed += !r.passed();
+  if (opts.junit) {
+    std::cout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+              << "<testsuite name=\"" << xmlEscape(dir) << "\" tests=\""
+              << results.size() << "\" failures=\"" << failed << "\">\n";
+    for (CorpusResult &r : results) {
+      std::cout << "  <testcase name=\"" << xmlEscape(r.name) << "\" time=\""
+                << r.seconds << "\"";
+      if (r.passed()) {
+        std::cout << "/>\n";
+        continue;
+      }
+      std::cout << ">\n    <failure message=\"" << failure(r, opts)
+                << "\">Expected:\n"
+                << xmlEscape(r.expected) << "Got:\n"
+                << xmlEscape(r.got) << "</failure>\n  </testcase>\n";
+    }
+    std::cout << "</testsuite>\n";
+  }
+  else {
+    std::cout << "TAP version 13\n1.." << results.size() << "\n";
+    for (int k = 0; k < results.size(); k++) {
+      CorpusResult &r = results[k];
+      std::cout << (r.passed() ? "ok " : "not ok ") << k + 1 << " - " << r.name
+                << "\n";
+      if (r.passed()) continue;
+      std::cout << "  ---\n  message: " << failure(r, opts)
+                << "\n  expected: |\n"
+                << indent(r.expected, "    ") << "\n  got: |\n"
+                << indent(r.got, "    ") << "\n  ...\n";
+    }
+  }
+  return failed;
+}
+
+// readAll: Reads exactly n bytes, false on EOF or error
+static bool readAll(int fd, char *buf, size_t n)
+{
+  while (n > 0) {
+    ssize_t got = read(fd, buf, n);
+    if (got <= 0) return false;
+    buf += got;
+    n -= got;
+  }
+  return true;
+}
+
+static bool writeAll(int fd, const char *buf, size_t n)
+{
+  while (n > 0) {
+    ssize_t put = write(fd, buf, n);
+    if (put <= 0) return false;
+    buf += put;
+    n -= put;
+  }
+  return true;
+}
+
+// Frames are a 4 byte big-endian length followed by that many bytes
+//
+// size_t limit: the longest frame accepted, to refuse rather than allocate
+// whatever length a client claims
+
+static bool readFrame(int fd, std::string &frame,
+                      size_t limit = std::numeric_limits<uint32_t>::max())
+{
+  uint32_t len;
+  if (!readAll(fd, reinterpret_cast<char *>(&len), 4) || ntohl(len) > limit)
+    return false;
+  frame.resize(ntohl(len));
+  return readAll(fd, &frame[0], frame.size());
+}
+
+const size_t MAX_REQUEST = 16 << 20; // bytes of program the server accepts
+
+static bool writeFrame(int fd, std::string const &frame)
+{
+  uint32_t len = htonl(frame.size());
+  return writeAll(fd, reinterpret_cast<char *>(&len), 4) &&
+         writeAll(fd, frame.data(), frame.size());
+}
+
+static sockaddr_un socketAddress(std::string path)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+// loadPrelude: Runs a file of declarations into a session
+//
+// std::string prelude: the file
+// Session &session: the session it extends
+//
+// return bool: false if the file is missing or fails
+
+static bool loadPrelude(std::string prelude, Session &session)
+{
+  if (!std::ifstream(prelude).is_open()) {
+    std::cout << "Cannot read prelude " << prelude << "\n";
+    return false;
+  }
+  try {
+    interpret(loadProgram({{prelude, prelude}}), session);
+  }
+  catch (LexError err) {
+    reportError(err);
+    return false;
+  }
+  return true;
+}
+
+// serve: Answers programs sent over a Unix socket, one frame per connection.
+// The session is set up once before this; each connection is handed to a
+// forked child, which starts from the parent's warm heap copy-on-write, reads
+// the request and replies with everything the program printed.
+//
+// std::string path: where to create the socket
+// Session &session: the declarations shared by every request
+// CorpusOptions opts: the per-request timeout
+//
+// return int: exit status
+
+int serve(std::string path, Session &session, CorpusOptions opts)
+{
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr = socketAddress(path);
+  unlink(path.c_str());
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+      listen(listener, 64)) {
+    perror("MiniML --serve");
+    return 1;
+  }
+  signal(SIGCHLD, SIG_IGN); // children are never waited for
+  signal(SIGPIPE, SIG_IGN); // a client gone before its reply is no matter
+  std::cout << "Serving on " << path << "\n";
+  std::cout.flush();
+
+  for (;;) {
+    int conn = accept(listener, nullptr, nullptr);
+    if (conn < 0) continue;
+    pid_t child = fork();
+    if (child < 0) {
+      writeFrame(conn, std::string("Cannot run the request: ") +
+                           strerror(errno) + "\n");
+      close(conn);
+      continue;
+    }
+    if (child == 0) {
+      close(listener);
+      // the request is read here, so a slow client holds up only its child,
+      // and for no longer than the timeout
+      timeval wait{static_cast<time_t>(opts.timeout),
+                   static_cast<suseconds_t>(
+                       (opts.timeout - static_cast<time_t>(opts.timeout)) *
+                       1e6)};
+      setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+      std::string program;
+      if (!readFrame(conn, program, MAX_REQUEST)) {
+        writeFrame(conn, "Request unreadable, or longer than " +
+                             std::to_string(MAX_REQUEST) + " bytes\n");
+        _exit(1);
+      }
+      std::ostringstream out;
+      EvalContext ctx;
+      ctx.out.sink(&out);
+      ctx.deadline = std::chrono::steady_clock::now() +
+                     std::chrono::duration_cast<
+                         std::chrono::steady_clock::duration>(
+                         std::chrono::duration<double>(opts.timeout));
+      ContextScope scope(&ctx);
+      InputStream i{program};
+      try {
+        interpret(TokenStream("request", &i), session);
+      }
+      catch (LexError err) {
+        reportError(err);
+      }
+      ctx.out.flush();
+      writeFrame(conn, out.str());
+      _exit(0);
+    }
+    close(conn);
+  }
+}
+
+// send: Submits a program file to a server and prints its reply
+//
+// std::string path: the server's socket
+// std::string file: the program
+//
+// return int: exit status
+
+int send(std::string path, std::string file)
+{
+  std::ifstream in(file);
+  if (!in.is_open()) {
+    std::cout << "Cannot read " << file << "\n";
+    return 1;
+  }
+  std::stringstream program;
+  program << in.rdbuf();
+  int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr = socketAddress(path);
+  std::string reply;
+  if (conn < 0 ||
+      connect(conn, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+      !writeFrame(conn, program.str()) || !readFrame(conn, reply)) {
+    std::cout << "No reply from " << path << "\n";
+    return 1;
+  }
+  close(conn);
+  std::cout << reply;
+  return 0;
+}
+
+// emitCpp: Writes the C++ translation of a program to std::cout
+//
+// std::string sourcename: the file the program came from
+// std::shared_ptr<AstBranch> prog: the parsed program
+
+void emitCpp(std::string sourcename, std::shared_ptr<AstBranch> prog)
 {
-  std::shared_ptr<AstBranch> ast = SMLParser(&tks)();
-  tks.checkEOF();
-  std::shared_ptr<SMLValue> result = eval(ast);
-  std::cout << "Out: " << result->to_string_typed() << "\n";
-  return result;
+  std::cout << CppEmitter(sourcename)(prog);
+}
+
+// printAllocStats: Reports the value allocator's size classes on stderr
+void printAllocStats(void)
+{
+  std::cerr << "class      live      bytes  slabs\n";
+  for (SlabStats &s : slabStats()) {
+    char line[64];
+    snprintf(line, sizeof(line), "%-6s %8zu %10zu %6zu\n", s.name.c_str(),
+             s.live, s.bytes, s.slabs);
+    std::cerr << line;
+  }
 }
 
 int main(int argc, char **argv)
 {
-  if (argc == 2 && !strcmp(argv[1], "test")) {
+  std::vector<std::string> args;
+  bool emit_cpp{false};
+  bool alloc_stats{false};
+  bool allow_use{false}; // in programs sent to the server
+  CorpusOptions corpus;
+  std::string serve_path, send_path, prelude, load_image, save_image;
+  for (int a = 1; a < argc; a++) {
+    if (!strcmp(argv[a], "--emit-cpp"))
+      emit_cpp = true;
+    else if (!strcmp(argv[a], "--no-jit"))
+      JIT.enabled = false;
+    else if (!strcmp(argv[a], "--no-simd"))
+      SIMD.enabled = false;
+    else if (!strcmp(argv[a], "--perf-map"))
+      JIT.perf_map = true;
+    else if (!strcmp(argv[a], "--parallel"))
+      PARALLEL.enabled = true;
+    else if (!strcmp(argv[a], "--jobs") && a + 1 < argc)
+      PARALLEL.workers = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--timeout") && a + 1 < argc)
+      corpus.timeout = atof(argv[++a]);
+    else if (!strcmp(argv[a], "--max-steps") && a + 1 < argc)
+      LIMITS.steps = atol(argv[++a]);
+    else if (!strcmp(argv[a], "--max-bytes") && a + 1 < argc)
+      LIMITS.bytes = atol(argv[++a]);
+    else if (!strcmp(argv[a], "--max-seconds") && a + 1 < argc)
+      LIMITS.seconds = atof(argv[++a]);
+    else if (!strcmp(argv[a], "--junit"))
+      corpus.junit = true;
+    else if (!strcmp(argv[a], "--serve") && a + 1 < argc)
+      serve_path = argv[++a];
+    else if (!strcmp(argv[a], "--allow-use"))
+      allow_use = true;
+    else if (!strcmp(argv[a], "--prelude") && a + 1 < argc)
+      prelude = argv[++a];
+    else if (!strcmp(argv[a], "--send") && a + 1 < argc)
+      send_path = argv[++a];
+    else if (!strcmp(argv[a], "--alloc-stats"))
+      alloc_stats = true;
+    else if (!strcmp(argv[a], "--no-gc"))
+      GC.enabled = false;
+    else if (!strcmp(argv[a], "--no-cache"))
+      AST_CACHE.enabled = false;
+    else if (!strcmp(argv[a], "--cache-dir") && a + 1 < argc)
+      AST_CACHE.dir = argv[++a];
+    else if (!strcmp(argv[a], "--load-image") && a + 1 < argc)
+      load_image = argv[++a];
+    else if (!strcmp(argv[a], "--save-image") && a + 1 < argc)
+      save_image = argv[++a];
+    else
+      args.push_back(argv[a]);
+  }
+
+  Session session;
+  if (load_image.size() &&
+      !loadImage(load_image, session.env, session.prints)) {
+    std::cout << "Cannot load image " << load_image << "\n";
+    return 1;
+  }
+  if (prelude.size() && !loadPrelude(prelude, session)) return 1;
+
+  if (serve_path.size()) {
+    session.use_files = allow_use;
+    return serve(serve_path, session, corpus);
+  }
+  else if (send_path.size() && args.size() == 1) {
+    return send(send_path, args[0]);
+  }
+  else if (args.size() == 1 && args[0] == "test") {
     return unitTestAll();
   }
-  else if (argc >= 2) {
-    InputStream i;
-    i.get_file(argv[1]);
+  else if (args.size() == 2 && args[0] == "test") {
+    return runCorpus(args[1], corpus);
+  }
+  else if (args.size() >= 1) {
+    std::vector<SourceFile> files;
+    for (std::string &a : args)
+      files.push_back({a, a});
     try {
-      interpret(TokenStream(argv[1], &i));
+      if (emit_cpp)
+        emitCpp(args[0], loadProgram(files));
+      else
+        interpret(loadProgram(files), session);
     }
     catch (LexError err) {
-      std::cout << "\nError caught:\n";
-      std::cout << err.what() << "\n";
+      reportError(err);
+      context().out.flush();
+      if (save_image.size()) return 1; // nothing half-run is saved
     }
   }
-  else { // process typed line
+  else if (save_image.empty()) { // process typed line
 
     InputStream i;
+    // top-level declarations last until the REPL exits
     std::cout << "Type something, I dare you!\n"
                  "SML Input:\n";
-    while (i.get_full_line())
+    while (i.get_full_line()) {
       try {
-        interpret(TokenStream("STDIN", &i));
+        interpret(TokenStream("STDIN", &i), session);
       }
       catch (LexError err) {
-        std::cout << "\nError caught:\n";
-        std::cout << err.what() << "\n";
+        reportError(err);
       }
+      context().out.flush(); // before waiting for the next line
+    }
     std::cout << "Functional programming will always be here!\n"
                  "No point running!\n";
   }
+  context().out.flush();
+  if (alloc_stats) printAllocStats();
+  if (save_image.size() &&
+      !saveImage(save_image, session.env, session.prints)) {
+    std::cout << "Cannot write image " << save_image << "\n";
+    return 1;
+  }
 }
@@ -0,0 +1,197 @@
+#include "module.h"
+#include "astcache.h"
+#include "parallel.h"
+#include <atomic>
+#include <exception>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+std::string readSource(std::filesystem::path path)
+{
+  std::ifstream file(path);
+  std::stringstream ss;
+  ss << file.rdbuf();
+  return ss.str();
+}
+
+std::shared_ptr<AstBranch> parseFile(std::string sourcename,
+                                     std::filesystem::path path)
+{
+  std::string source = readSource(path);
+  if (AST_CACHE.enabled)
+    if (std::shared_ptr<AstBranch> prog = loadCachedProgram(sourcename, source))
+      return prog;
+  InputStream i{source};
+  TokenStream tks(sourcename, &i);
+  std::shared_ptr<AstBranch> prog = SMLParser(&tks).program();
+  tks.checkEOF();
+  if (AST_CACHE.enabled) saveCachedProgram(sourcename, source, prog);
+  return prog;
+}
+
+// Module: one file of a program being loaded
+struct Module {
+  SourceFile file;
+  std::string used_at; // where the first `use` of it is, empty for a root
+  std::shared_ptr<AstBranch> prog;
+  std::exception_ptr error; // from reading or parsing, thrown when linked
+  std::vector<int> uses;    // the module each UseFile item names, in order
+  enum { Unlinked, Linking, Linked } state{Unlinked};
+};
+
+// ModuleGraph: the files of a program and the `use` edges between them
+class ModuleGraph {
+    public:
+  int add(SourceFile file, std::string used_at);
+  void parse(void);
+  void link(int k, std::shared_ptr<AstBranch> out);
+  std::vector<Module> modules;
+
+    private:
+  void parseLevel(size_t begin, size_t end);
+  std::unordered_map<std::string, int> index; // by canonical path
+};
+
+// ModuleGraph::add: The module for a file, added if this is its first use
+int ModuleGraph::add(SourceFile file, std::string used_at)
+{
+  std::error_code ec;
+  std::filesystem::path key = std::filesystem::weakly_canonical(file.path, ec);
+  if (ec) key = file.path.lexically_normal();
+  auto found = index.find(key.string());
+  if (found != index.end()) return found->second;
+  index[key.string()] = modules.size();
+  modules.push_back(Module{file, used_at});
+  return modules.size() - 1;
+}
+
+static void parseModule(Module &m)
+{
+  if (m.prog) return; // given already parsed, as linkProgram's is
+  try {
+    if (!std::ifstream(m.file.path).is_open())
+      throw ParseError("Cannot read " + m.file.name +
+                       (m.used_at.size() ? " used at " + m.used_at : "") +
+                       ".");
+    m.prog = parseFile(m.file.name, m.file.path);
+  }
+  catch (...) {
+    m.error = std::current_exception();
+  }
+}
+
+// ModuleGraph::parseLevel: Parses modules [begin, end), all found by
+// parsing the level before, sharding them across threads as runCorpus does
+void ModuleGraph::parseLevel(size_t begin, size_t end)
+{
+  std::atomic<size_t> next{begin};
+  auto work = [&]() {
+    for (size_t k; (k = next++) < end;)
+      parseModule(modules[k]);
+  };
+  int shards = PARALLEL.workers > 0
+                   ? PARALLEL.workers
+                   : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (int t = 1; t < std::min<size_t>(shards, end - begin); t++)
+    threads.push_back(std::thread(work));
+  work();
+  for (std::thread &t : threads)
+    t.join();
+}
+
+// ModuleGraph::parse: Parses every module not parsed yet, then the modules
+// they use, until no new file turns up
+void ModuleGraph::parse(void)
+{
+  size_t begin = 0;
+  while (begin < modules.size()) {
+    size_t end = modules.size();
+    parseLevel(begin, end);
+    for (size_t k = begin; k < end; k++) {
+      if (!modules[k].prog) continue;
+      std::shared_ptr<AstBranch> prog = modules[k].prog;
+      for (int i = 0; i < prog->count(); i++) {
+        std::shared_ptr<AstBranch> item =
+            std::static_pointer_cast<AstBranch>(prog->get(i));
+        if (item->label() != Label::UseFile) continue;
+        std::string file =
+            std::static_pointer_cast<AstString>(item->get(0))->get_string();
+        SourceFile used{
+            (std::filesystem::path(modules[k].file.name).parent_path() / file)
+                .lexically_normal()
+                .string(),
+            modules[k].file.path.parent_path() / file};
+        int u = add(used, item->where());
+        modules[k].uses.push_back(u);
+      }
+    }
+    begin = end;
+  }
+}
+
+// ModuleGraph::link: Appends a module's items to out, each module it uses
+// in place of the `use`, unless already linked
+void ModuleGraph::link(int k, std::shared_ptr<AstBranch> out)
+{
+  Module &m = modules[k];
+  if (m.state == Module::Linked) return;
+  if (m.error) std::rethrow_exception(m.error);
+  m.state = Module::Linking;
+  int use = 0;
+  for (int i = 0; i < m.prog->count(); i++) {
+    std::shared_ptr<AstBranch> item =
+        std::static_pointer_cast<AstBranch>(m.prog->get(i));
+    if (item->label() != Label::UseFile) {
+      out->add(item);
+      continue;
+    }
+    int u = m.uses.at(use++);
+    if (modules[u].state == Module::Linking)
+      throw ParseError("Cyclic use of " + modules[u].file.name + " at " +
+                       item->where() + ".");
+    link(u, out);
+  }
+  m.state = Module::Linked;
+}
+
+static bool usesFiles(std::shared_ptr<AstBranch> prog)
+{
+  for (int i = 0; i < prog->count(); i++)
+    if (prog->get(i)->label() == Label::UseFile) return true;
+  return false;
+}
+
+static std::shared_ptr<AstBranch> linkAll(ModuleGraph &graph, int roots)
+{
+  graph.parse();
+  // a lone file that uses nothing needs no copying
+  if (graph.modules.size() == 1 && !graph.modules[0].error &&
+      !usesFiles(graph.modules[0].prog))
+    return graph.modules[0].prog;
+  std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
+  out->label(Label::Program);
+  for (int k = 0; k < roots; k++) {
+    if (k == 0 && graph.modules[k].prog)
+      out->where(graph.modules[k].prog->where());
+    graph.link(k, out);
+  }
+  return out;
+}
+
+std::shared_ptr<AstBranch> loadProgram(std::vector<SourceFile> roots)
+{
+  ModuleGraph graph;
+  for (SourceFile &f : roots)
+    graph.add(f, "");
+  return linkAll(graph, graph.modules.size());
+}
+
+std::shared_ptr<AstBranch> linkProgram(std::shared_ptr<AstBranch> prog)
+{
+  if (!usesFiles(prog)) return prog;
+  ModuleGraph graph;
+  graph.modules.push_back(Module{SourceFile{"", ""}, "", prog});
+  return linkAll(graph, 1);
+}
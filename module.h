@@ -0,0 +1,42 @@
+#pragma once
+#include "parser.h"
+#include <filesystem>
+#include <vector>
+
+// SourceFile: a file to load, and the name positions in it are reported
+// against
+struct SourceFile {
+  std::string name;
+  std::filesystem::path path;
+};
+
+// readSource: The text of a file, empty if it cannot be read
+std::string readSource(std::filesystem::path path);
+
+// parseFile: Parses a source file, going through the AST cache when it is
+// enabled
+//
+// std::string sourcename: the name positions are reported against
+// std::filesystem::path path: the file
+//
+// return std::shared_ptr<AstBranch>: a Program node
+
+std::shared_ptr<AstBranch> parseFile(std::string sourcename,
+                                     std::filesystem::path path);
+
+// loadProgram: Parses files and every file they `use`, then links them into
+// one Program. Files are read a dependency level at a time, the files of a
+// level lexed and parsed concurrently, each with a stream and parser of its
+// own. A file is parsed and run once however many files use it, at the point
+// of its first `use`; a `use` path is relative to the file it appears in.
+//
+// std::vector<SourceFile> roots: the files named on the command line, in
+// the order they run
+//
+// return std::shared_ptr<AstBranch>: a Program node with no UseFile items
+
+std::shared_ptr<AstBranch> loadProgram(std::vector<SourceFile> roots);
+
+// linkProgram: The same for a program typed or sent rather than read from a
+// file, whose `use` paths are relative to the working directory
+std::shared_ptr<AstBranch> linkProgram(std::shared_ptr<AstBranch> prog);
@@ -0,0 +1,55 @@
+#include "output.h"
+#include <charconv>
+#include <cstring>
+
+Output::Output(std::ostream *sink, size_t capacity_)
+    : to(sink), capacity(capacity_)
+{
+}
+
+Output::~Output() { flush(); }
+
+void Output::sink(std::ostream *s)
+{
+  flush();
+  to = s;
+}
+
+void Output::spill(void)
+{
+  if (buf)
+    flush();
+  else {
+    buf.reset(new char[capacity]);
+    cap = capacity;
+  }
+}
+
+void Output::write(std::string_view s)
+{
+  if (s.size() > cap - used) {
+    spill();
+    if (s.size() > cap - used) { // bigger than the whole buffer
+      flush();
+      to->write(s.data(), s.size());
+      return;
+    }
+  }
+  memcpy(buf.get() + used, s.data(), s.size());
+  used += s.size();
+}
+
+void Output::integer(int n)
+{
+  char digits[16];
+  char *end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+  write(std::string_view(digits, end - digits));
+}
+
+void Output::flush(void)
+{
+  if (!used) return;
+  to->write(buf.get(), used);
+  to->flush();
+  used = 0;
+}
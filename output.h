@@ -0,0 +1,38 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <string_view>
+
+// Bytes an Output gathers before writing them out
+const size_t OUTPUT_BYTES = 64 * 1024;
+
+// Output: what a program prints, gathered in one buffer in front of a
+// stream. The buffer is written out when it fills, when flushed (before an
+// error report or a REPL prompt, say) and when the Output goes away.
+class Output {
+    public:
+  Output(std::ostream *sink = &std::cout, size_t capacity = OUTPUT_BYTES);
+  Output(Output const &) = delete;
+  ~Output();
+
+  std::ostream *sink(void) { return to; }
+  void sink(std::ostream *s); // flushes into the old sink first
+
+  void put(char c)
+  {
+    if (used == cap) spill();
+    buf[used++] = c;
+  }
+  void write(std::string_view s);
+  void integer(int n);
+  void flush(void);
+
+    private:
+  void spill(void); // makes room for at least one byte
+
+  std::ostream *to;
+  std::unique_ptr<char[]> buf; // allocated on first use
+  size_t used{0};
+  size_t cap{0};
+  size_t capacity;
+};
@@ -0,0 +1,372 @@
+#include "parallel.h"
+#include "eval.h"
+#include "jit.h"
+#include <limits>
+#include <map>
+#include <set>
+
+ParallelOptions PARALLEL;
+
+static thread_local int pool_slot = -1;
+static thread_local int fork_depth = 0;
+
+// WorkPool::get: The pool, started on first use with a thread per
+// PARALLEL.workers, but no more than there are hardware threads: once a
+// second thread exists every reference count update is atomic, which costs
+// more than threads sharing a core gain
+WorkPool &WorkPool::get(void)
+{
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  static WorkPool pool(PARALLEL.workers > 0 ? std::min(PARALLEL.workers, cores)
+                                            : cores);
+  return pool;
+}
+
+// WorkPool::WorkPool: Starts n-1 workers; the evaluating thread is the nth
+//
+// int n: number of threads working on the program
+
+WorkPool::WorkPool(int n)
+{
+  for (int i = 0; i < n; i++)
+    deques.push_back(std::unique_ptr<Deque>(new Deque));
+  for (int i = 1; i < n; i++)
+    threads.push_back(std::thread(&WorkPool::loop, this, i));
+}
+
+WorkPool::~WorkPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(sleep_m);
+    stopping = true;
+  }
+  sleep_cv.notify_all();
+  for (std::thread &t : threads)
+    t.join();
+}
+
+int WorkPool::slot(void) { return pool_slot < 0 ? 0 : pool_slot; }
+
+void WorkPool::fork(Task *t)
+{
+  Deque &d = *deques[slot()];
+  {
+    std::lock_guard<std::mutex> lock(d.m);
+    d.tasks.push_back(t);
+  }
+  queued++;
+  wake();
+}
+
+// WorkPool::wake: Rouses sleepers to look for work or their task again.
+// They check under sleep_m after counting themselves in waiting, so taking it
+// here means none can miss this.
+void WorkPool::wake(void)
+{
+  if (!waiting) return;
+  std::lock_guard<std::mutex> lock(sleep_m);
+  sleep_cv.notify_all();
+}
+
+Task *WorkPool::pop(int me)
+{
+  Deque &d = *deques[me];
+  std::lock_guard<std::mutex> lock(d.m);
+  if (d.tasks.empty()) return nullptr;
+  Task *t = d.tasks.back();
+  d.tasks.pop_back();
+  queued--;
+  return t;
+}
+
+Task *WorkPool::steal(int me)
+{
+  for (int k = 1; k < deques.size(); k++) {
+    Deque &d = *deques[(me + k) % deques.size()];
+    std::lock_guard<std::mutex> lock(d.m);
+    if (d.tasks.empty()) continue;
+    Task *t = d.tasks.front();
+    d.tasks.pop_front();
+    queued--;
+    return t;
+  }
+  return nullptr;
+}
+
+void WorkPool::run(Task *t)
+{
+  stackFloor(); // eval checks it on whichever thread the task lands
+  try {
+    t->fn();
+  }
+  catch (...) {
+    t->error = std::current_exception();
+  }
+  t->done = true;
+  wake();
+}
+
+// WorkPool::join: Helps with queued work while t is unfinished, and sleeps
+// once there is none until t is done or more is queued
+
+void WorkPool::join(Task *t)
+{
+  int me = slot();
+  while (!t->done) {
+    Task *other = pop(me);
+    if (!other) other = steal(me);
+    if (other) {
+      run(other);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_m);
+    waiting++;
+    sleep_cv.wait(lock, [this, t]() { return t->done || queued > 0; });
+    waiting--;
+  }
+  if (t->error) std::rethrow_exception(t->error);
+}
+
+void WorkPool::loop(int me)
+{
+  pool_slot = me;
+  stackFloor();
+  while (!stopping) {
+    Task *t = pop(me);
+    if (!t) t = steal(me);
+    if (t) {
+      run(t);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_m);
+    waiting++;
+    sleep_cv.wait(lock, [this]() { return stopping || queued > 0; });
+    waiting--;
+  }
+}
+
+// Cancel: a pair being evaluated, failed once either half throws. Halves
+// nested in it, on whatever thread, see that at their next poll.
+struct Cancel {
+  std::atomic<bool> failed{false};
+  Cancel *outer{nullptr};
+};
+
+static thread_local Cancel *cancel_chain = nullptr;
+
+bool inParallel(void) { return cancel_chain; }
+
+bool parallelCancelled(void)
+{
+  for (Cancel *c = cancel_chain; c; c = c->outer)
+    if (c->failed) return true;
+  return false;
+}
+
+// within: Runs one half of a pair, nested depth pairs deep, failing the pair
+// if it throws
+static void within(Cancel *pair, int depth, std::function<void(void)> &half)
+{
+  int saved_depth = fork_depth;
+  Cancel *saved_chain = cancel_chain;
+  fork_depth = depth;
+  cancel_chain = pair;
+  try {
+    half();
+  }
+  catch (...) {
+    fork_depth = saved_depth;
+    cancel_chain = saved_chain;
+    pair->failed = true;
+    jitInterrupt(); // native code never polls
+    throw;
+  }
+  fork_depth = saved_depth;
+  cancel_chain = saved_chain;
+}
+
+static bool cancelled(std::exception_ptr error)
+{
+  try {
+    std::rethrow_exception(error);
+  }
+  catch (Cancelled &) {
+    return true;
+  }
+  catch (...) {
+    return false;
+  }
+}
+
+void parallelInvoke(std::function<void(void)> left,
+                    std::function<void(void)> right)
+{
+  WorkPool &pool = WorkPool::get();
+  // without another thread to take left, right would run first
+  if (fork_depth >= PARALLEL.max_depth || pool.size() < 2) {
+    left();
+    right();
+    return;
+  }
+  int depth = fork_depth + 1;
+  Cancel pair;
+  pair.outer = cancel_chain;
+  Task t;
+  t.fn = [&pair, &left, depth]() { within(&pair, depth, left); };
+  pool.fork(&t);
+  std::exception_ptr left_error, right_error;
+  try {
+    within(&pair, depth, right);
+  }
+  catch (...) {
+    right_error = std::current_exception();
+  }
+  try {
+    pool.join(&t);
+  }
+  catch (...) {
+    left_error = std::current_exception();
+  }
+  if (left_error && !(right_error && cancelled(left_error)))
+    std::rethrow_exception(left_error);
+  if (right_error) std::rethrow_exception(right_error);
+}
+
+static bool contains(std::shared_ptr<AstNode> node, Label l)
+{
+  if (node->label() == l) return true;
+  if (!node->is_branch()) return false;
+  std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(node);
+  for (int i = 0; i < ast->count(); i++)
+    if (contains(ast->get(i), l)) return true;
+  return false;
+}
+
+// Steps stand for any number when a call may recurse or reach any function
+const long UNBOUNDED = std::numeric_limits<long>::max() / 4;
+
+static long add(long a, long b) { return std::min(a + b, UNBOUNDED); }
+
+static std::string name(std::shared_ptr<AstNode> node)
+{
+  return std::static_pointer_cast<AstString>(node)->get_string();
+}
+
+static bool mentions(std::shared_ptr<AstNode> node,
+                     std::set<std::string> const &names)
+{
+  if (!node->is_branch()) return false;
+  std::shared_ptr<AstBranch> ast = std::static_pointer_cast<AstBranch>(node);
+  if (ast->label() == Label::Var) return names.count(name(ast->get(0)));
+  for (int i = 0; i < ast->count(); i++)
+    if (mentions(ast->get(i), names)) return true;
+  return false;
+}
+
+// Functions: the program's `fun`s by name, to estimate calls by. Scopes are
+// ignored: a name declared twice, or by a recursive group, is unbounded.
+struct Functions {
+  std::map<std::string, std::shared_ptr<AstNode>> bodies;
+  std::set<std::string> unbounded;
+  std::map<std::string, long> steps; // of the bodies estimated so far
+  std::map<AstNode *, long> lambdas;  // the steps of each fn's body
+
+  void gather(std::shared_ptr<AstNode> node)
+  {
+    if (!node->is_branch()) return;
+    std::shared_ptr<AstBranch> ast = std::static_pointer_cast<AstBranch>(node);
+    if (ast->label() == Label::Fun || ast->label() == Label::Funs) {
+      std::vector<std::shared_ptr<AstBranch>> group;
+      if (ast->label() == Label::Fun) group.push_back(ast);
+      for (int i = 0; ast->label() == Label::Funs && i < ast->count(); i++)
+        group.push_back(std::static_pointer_cast<AstBranch>(ast->get(i)));
+      std::set<std::string> names;
+      for (auto fun : group)
+        names.insert(name(fun->get(0)));
+      for (auto fun : group) {
+        std::string f = name(fun->get(0));
+        if (bodies.count(f) || unbounded.count(f) ||
+            mentions(fun->get(2), names)) {
+          bodies.erase(f);
+          unbounded.insert(f);
+        }
+        else
+          bodies[f] = fun->get(2);
+        gather(fun->get(2));
+      }
+      return;
+    }
+    for (int i = 0; i < ast->count(); i++)
+      gather(ast->get(i));
+  }
+};
+
+static long plan(std::shared_ptr<AstNode> node, bool pure, Functions &fns);
+
+// call: The steps an App spends in the function it applies
+static long call(std::shared_ptr<AstBranch> app, bool pure, Functions &fns)
+{
+  std::shared_ptr<AstNode> head = app->get(0);
+  if (head->label() == Label::App) return 0; // counted by the inner App
+  if (head->label() == Label::Lam) return fns.lambdas[head.get()];
+  if (head->label() != Label::Var) return UNBOUNDED;
+  std::string f = name(std::static_pointer_cast<AstBranch>(head)->get(0));
+  if (!fns.bodies.count(f)) return UNBOUNDED;
+  if (!fns.steps.count(f)) {
+    fns.steps[f] = UNBOUNDED; // through a name declared again further in
+    fns.steps[f] = plan(fns.bodies[f], pure, fns);
+  }
+  return fns.steps[f];
+}
+
+// plan: Post-order walk that marks PairUp nodes
+//
+// std::shared_ptr<AstNode> node: the subtree
+// bool pure: whether calls are known not to print
+// Functions &fns: the functions calls are estimated by
+//
+// return long: about how many eval steps the subtree takes
+
+static long plan(std::shared_ptr<AstNode> node, bool pure, Functions &fns)
+{
+  if (!node->is_branch()) return 0;
+  std::shared_ptr<AstBranch> ast = std::dynamic_pointer_cast<AstBranch>(node);
+  long steps = 1;
+  std::vector<long> parts;
+  for (int i = 0; i < ast->count(); i++) {
+    parts.push_back(plan(ast->get(i), pure, fns));
+    steps = add(steps, parts.back());
+  }
+  switch (ast->label()) {
+  case Label::Fun:
+    if (fns.bodies.count(name(ast->get(0))))
+      fns.steps.emplace(name(ast->get(0)), parts[2]);
+    return 1; // makes a closure; its body runs where it is called
+  case Label::Lam:
+    fns.lambdas[ast.get()] = parts[1];
+    return 1;
+  case Label::Funs:
+    return 1;
+  case Label::App:
+    return add(steps, call(ast, pure, fns));
+  case Label::PairUp:
+    // a task costs the steps of a few thousand cycles; cheaper halves are
+    // better evaluated in place
+    ast->fork(pure && parts[0] >= PARALLEL.min_steps &&
+              parts[1] >= PARALLEL.min_steps);
+    return steps;
+  default:
+    return steps;
+  }
+}
+
+// A call could reach any function in the program, so a component that calls
+// anything is only free of print when the whole program is.
+bool planParallel(std::shared_ptr<AstNode> program, bool prints)
+{
+  prints = prints || contains(program, Label::Print);
+  Functions fns;
+  fns.gather(program);
+  plan(program, !prints, fns);
+  return prints;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "parser.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct ParallelOptions {
+  bool enabled{false};
+  int workers{0};    // 0 means one per hardware thread
+  int max_depth{12}; // pairs nested deeper than this are evaluated in place
+  long min_steps{256}; // estimated eval steps each half needs to be forked
+};
+
+extern ParallelOptions PARALLEL;
+
+// Task: a forked computation. It lives on the stack of the thread that forked
+// it, which always joins it before returning.
+struct Task {
+  std::function<void(void)> fn;
+  std::atomic<bool> done{false};
+  std::exception_ptr error;
+};
+
+// WorkPool: a work-stealing pool. Each participant pushes and pops its own
+// deque at the back and steals from the front of the others'. Threads outside
+// the pool share the first deque.
+class WorkPool {
+    public:
+  static WorkPool &get(void);
+  void fork(Task *t);
+  void join(Task *t); // runs other work until t is done, rethrows its error
+  int size(void) { return deques.size(); }
+  ~WorkPool();
+
+    private:
+  WorkPool(int n);
+  struct Deque {
+    std::mutex m;
+    std::deque<Task *> tasks;
+  };
+  int slot(void);
+  Task *pop(int me);
+  Task *steal(int me);
+  void run(Task *t);
+  void loop(int me);
+  void wake(void);
+
+  std::vector<std::unique_ptr<Deque>> deques;
+  std::vector<std::thread> threads;
+  std::atomic<bool> stopping{false};
+  std::atomic<int> queued{0};
+  std::atomic<int> waiting{0}; // threads asleep in loop or join
+  std::mutex sleep_m;
+  std::condition_variable sleep_cv;
+};
+
+// parallelInvoke: Runs left and right, possibly at the same time. Errors are
+// reported as if left had run first, except that once either half fails the
+// other is stopped at its next poll: a left half stopped that way reports
+// right's error, so a pair whose right half never ends still fails.
+void parallelInvoke(std::function<void(void)> left,
+                    std::function<void(void)> right);
+
+// Cancelled: thrown into the half of a pair whose other half failed, and
+// replaced by that failure before it leaves parallelInvoke
+struct Cancelled {};
+
+// inParallel: Whether the calling thread is running half of a pair
+bool inParallel(void);
+// parallelCancelled: Whether a pair the calling thread is running half of
+// has failed, so the work is no longer wanted
+bool parallelCancelled(void);
+
+// planParallel: Marks the PairUp nodes of a program whose components are
+// worth evaluating in parallel and cannot print. A component is worth it
+// when its estimated steps reach PARALLEL.min_steps: calls to recursive or
+// unknown functions count as unbounded, calls to the program's other
+// functions as the steps of their bodies. `prints` says whether
+// functions defined earlier (say, by a prelude) might; the result says the
+// same once this program has been loaded too.
+bool planParallel(std::shared_ptr<AstNode> program, bool prints = false);
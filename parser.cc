@@ -1,4 +1,13 @@
 #include "parser.h"
+#include "builtin.h"
+
+const std::vector<std::string> SMLParser::BINOPS = {
+    "andalso", "orelse", "<", "=", "+", "-", "^", "*", "div", "mod"};
+const std::vector<std::string> SMLParser::STOPPERS = {
+    "then", "else", "in", "and", "end", ")", "]", ";", ",", "eof", "val", "fun",
+    "use", "andalso", "orelse", "<", "=", "+", "-", "^", "*", "div", "mod"};
+const std::vector<std::string> SMLParser::MULTOPPS = {"*", "div", "mod"};
+const std::vector<std::string> SMLParser::ADDNOPPS = {"+", "-", "^"};
 
 std::string AstNode::string_label(void) { return label_to_string(_label); }
 
@@ -10,6 +19,8 @@ void AstBranch::add(std::string str) { args.push_back(AstString::New(str)); }
 
 std::shared_ptr<AstNode> AstBranch::get(int n) { return args.at(n); }
 
+void AstBranch::set(int n, std::shared_ptr<AstNode> node) { args.at(n) = node; }
+
 int AstBranch::count(void) { return args.size(); }
 
 std::string AstBranch::where(void) { return _where; }
@@ -43,57 +54,7 @@ std::shared_ptr<AstBranch> SMLParser::parseExpn(void)
   }
   else if (tks->next() == "let") {
     tks->eat("let");
-    std::shared_ptr<AstBranch> d =
-        std::shared_ptr<AstBranch>(new AstBranch); // used in if and else
-    if (tks->next() == "val") {
-      tks->eat("val");
-      std::string where_x = tks->report();
-      std::string x = tks->eatName();
-      tks->eat("=");
-      std::shared_ptr<AstBranch> r = parseExpn();
-      d->label(Label::Val);
-      d->where(where_x);
-      d->add(x);
-      d->add(r);
-    }
-    else {
-      tks->eat("fun");
-      std::string where_f = tks->report();
-      std::string f = tks->eatName();
-      std::string x = tks->eatName();
-      tks->eat("=");
-      std::shared_ptr<AstBranch> r = parseExpn();
-      d->label(Label::Fun);
-      d->add(f);
-      d->add(x);
-      d->add(r);
-      d->where(where_f);
-      while (tks->next() == "and") {
-        std::shared_ptr<AstBranch> dtmp =
-            std::shared_ptr<AstBranch>(new AstBranch); // for use in the loop
-        std::string where_and = tks->report();
-        tks->eat("and");
-        std::string where_f = tks->report();
-        std::string f = tks->eatName();
-        std::string x = tks->eatName();
-        tks->eat("=");
-        std::shared_ptr<AstBranch> r = parseExpn();
-        // newing dp
-        std::shared_ptr<AstBranch> dp =
-            std::shared_ptr<AstBranch>(new AstBranch);
-        dp->label(Label::Fun);
-        dp->add(f);
-        dp->add(x);
-        dp->add(r);
-        dp->where(where_f);
-        // newing d fails as d is defined recursively on itself
-        dtmp->label(Label::Funs);
-        dtmp->add(d);
-        dtmp->add(dp);
-        dtmp->where(where_and);
-        d = dtmp;
-      }
-    }
+    std::shared_ptr<AstBranch> d = parseDecl();
     tks->eat("in");
     std::shared_ptr<AstBranch> b = parseExpn();
     std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
@@ -122,6 +83,99 @@ std::shared_ptr<AstBranch> SMLParser::parseExpn(void)
   }
 }
 
+std::shared_ptr<AstBranch> SMLParser::parseDecl(void)
+{
+  //
+  // <decl> ::= val <name> = <expn>
+  //          | fun <name> <name> = <expn> and ... and <name> <name> = <expn>
+  //
+  std::shared_ptr<AstBranch> d = std::shared_ptr<AstBranch>(new AstBranch);
+  if (tks->next() == "val") {
+    tks->eat("val");
+    std::string where_x = tks->report();
+    std::string x = tks->eatName();
+    tks->eat("=");
+    std::shared_ptr<AstBranch> r = parseExpn();
+    d->label(Label::Val);
+    d->where(where_x);
+    d->add(x);
+    d->add(r);
+  }
+  else {
+    tks->eat("fun");
+    d->label(Label::Funs);
+    for (;;) {
+      std::string where_f = tks->report();
+      std::string f = tks->eatName();
+      std::string x = tks->eatName();
+      tks->eat("=");
+      std::shared_ptr<AstBranch> r = parseExpn();
+      std::shared_ptr<AstBranch> fun =
+          std::shared_ptr<AstBranch>(new AstBranch);
+      fun->label(Label::Fun);
+      fun->add(f);
+      fun->add(x);
+      fun->add(r);
+      fun->where(where_f);
+      d->add(fun);
+      if (tks->next() != "and") break;
+      if (d->count() == 1) d->where(tks->report());
+      tks->eat("and");
+    }
+    // a lone function is a Fun; a group is one Funs node holding its Fun
+    // nodes in order
+    if (d->count() == 1) return std::static_pointer_cast<AstBranch>(d->get(0));
+  }
+  return d;
+}
+
+// SMLParser::program: Parses a whole source: declarations, `use` directives
+// and expressions, each optionally followed by semicolons
+//
+// return std::shared_ptr<AstBranch>: a Program node holding them in order
+
+std::shared_ptr<AstBranch> SMLParser::program(void)
+{
+  std::shared_ptr<AstBranch> out = std::shared_ptr<AstBranch>(new AstBranch);
+  out->label(Label::Program);
+  out->where(tks->report());
+  while (tks->next() != "eof")
+    out->add(item());
+  return out;
+}
+
+// SMLParser::item: Parses one top-level declaration, `use` directive or
+// expression, and the semicolons after it
+//
+// return std::shared_ptr<AstBranch>: the item
+
+std::shared_ptr<AstBranch> SMLParser::item(void)
+{
+  std::shared_ptr<AstBranch> out;
+  if (tks->next() == "val" || tks->next() == "fun")
+    out = parseDecl();
+  else if (tks->next() == "use")
+    out = parseUse();
+  else
+    out = parseExpn();
+  while (tks->next() == ";")
+    tks->eat(";");
+  return out;
+}
+
+std::shared_ptr<AstBranch> SMLParser::parseUse(void)
+{
+  //
+  // <use> ::= use "<file>"
+  //
+  std::shared_ptr<AstBranch> u = std::shared_ptr<AstBranch>(new AstBranch);
+  u->label(Label::UseFile);
+  u->where(tks->report());
+  tks->eat("use");
+  u->add(AstString::New(tks->eatString()));
+  return u;
+}
+
 std::shared_ptr<AstBranch> SMLParser::parseDisj(void)
 {
   std::shared_ptr<AstBranch> e = parseConj();
@@ -213,6 +267,15 @@ std::shared_ptr<AstBranch> SMLParser::parseAddn(void)
       tmp->where(where);
       e = tmp;
     }
+    else if (tks->next() == "^") {
+      tks->eat("^");
+      ep = parseMult();
+      tmp->label(Label::Concat);
+      tmp->add(e);
+      tmp->add(ep);
+      tmp->where(where);
+      e = tmp;
+    }
   }
   return e;
 }
@@ -293,7 +356,8 @@ std::shared_ptr<AstBranch> SMLParser::parsePrfx(void)
     throw ParseError("SMLParser::parsePrfx called on the empty string\n");
   //
   // <atom> ::= not <atom> | print <atom> | <atom>
-  //          | fst <atom> | snd <atom>
+  //          | fst <atom> | snd <atom> | #<int> <atom>
+  //          | Vector.<name> <atom>
   //
   std::shared_ptr<AstBranch> e, out;
   std::string where = tks->report();
@@ -338,6 +402,34 @@ std::shared_ptr<AstBranch> SMLParser::parsePrfx(void)
     return out;
   }
 
+  else if (tst_[0] == '#') {
+    std::string digits = tks->eat(tst_).substr(1);
+    int k = digits.size() < 10 ? std::stoi(digits) : 0;
+    if (k < 1)
+      throw SyntaxError("Tuple fields are numbered from 1, saw '" + tst_ +
+                        "' at " + where + ".");
+    e = parseAtom();
+    out = std::shared_ptr<AstBranch>(new AstBranch);
+    out->label(Label::Select);
+    out->add(e);
+    out->add(Label::Int, k);
+    out->where(where);
+    return out;
+  }
+
+  else if (isalpha(tst_[0]) && tst_.find('.') != std::string::npos) {
+    Builtin b = builtinNamed(tks->eat(tst_));
+    if (b == Builtin::Count)
+      throw SyntaxError("Unknown builtin '" + tst_ + "' at " + where + ".");
+    e = parseAtom();
+    out = std::shared_ptr<AstBranch>(new AstBranch);
+    out->label(Label::Prim);
+    out->add(Label::Int, static_cast<int>(b));
+    out->add(e);
+    out->where(where);
+    return out;
+  }
+
   else {
     return parseAtom();
   }
@@ -366,13 +458,14 @@ std::shared_ptr<AstBranch> SMLParser::parseAtom(void)
   //
   // <atom> ::= () | ( <expn> )
   //          | ( <expn> ; ... ; <expn> )
-  //          | ( <expn> , <expn> )
+  //          | ( <expn> , <expn> ) | ( <expn> , ... , <expn> )
   //
   else if (tks->next() == "(") {
-    std::shared_ptr<AstBranch> e, ep;
+    std::shared_ptr<AstBranch> e;
     tks->eat("(");
     // unit literal
     if (tks->next() == ")") {
+      e = out;
       e->label(Label::Literal);
       e->add(Label::Unit, 0);
       e->where(tks->report());
@@ -383,34 +476,58 @@ std::shared_ptr<AstBranch> SMLParser::parseAtom(void)
       // pairing up
       if (tks->next() == ",") {
         where = tks->report();
-        tks->eat(",");
-        ep = parseExpn();
-        out->label(Label::PairUp);
         out->add(e);
-        out->add(ep);
+        while (tks->next() == ",") {
+          tks->eat(",");
+          out->add(parseExpn());
+        }
+        out->label(out->count() == 2 ? Label::PairUp : Label::Tuple);
         out->where(where);
         e = out;
       }
 
-      else
-        // Sequencing
+      // Sequencing, one Seq node for the whole block
+      else if (tks->next() == ";") {
+        out->label(Label::Seq);
+        out->where(tks->report());
+        out->add(e);
         while (tks->next() == ";") {
-          out = std::shared_ptr<AstBranch>(new AstBranch);
-          where = tks->report();
           tks->eat(";");
-          ep = parseExpn();
-          // Out is not out this run
-          out->label(Label::Seq);
-          out->add(e);
-          out->add(ep);
-          out->where(where);
-          e = out;
+          out->add(parseExpn());
         }
+        e = out;
+      }
     }
     tks->eat(")");
     return e;
   }
 
+  //
+  // <atom> ::= "<text>"
+  //
+  else if (tks->nextIsString()) {
+    out->where(tks->report());
+    out->label(Label::Literal);
+    out->add(AstString::New(tks->eatString()));
+    return out;
+  }
+  //
+  // <atom> ::= [] | [ <expn> , ... , <expn> ]
+  //
+  else if (tks->next() == "[") {
+    out->where(tks->report());
+    tks->eat("[");
+    out->label(Label::Vec);
+    if (tks->next() != "]") {
+      out->add(parseExpn());
+      while (tks->next() == ",") {
+        tks->eat(",");
+        out->add(parseExpn());
+      }
+    }
+    tks->eat("]");
+    return out;
+  }
   //
   // <atom> ::= <name>
   //
@@ -489,6 +606,8 @@ std::string label_to_string(Label l)
     return "Plus";
   case Label::Minus:
     return "Minus";
+  case Label::Concat:
+    return "Concat";
   case Label::Times:
     return "Times";
   case Label::Div:
@@ -505,10 +624,18 @@ std::string label_to_string(Label l)
     return "First";
   case Label::Second:
     return "Second";
+  case Label::Select:
+    return "Select";
   case Label::Literal:
     return "Literal";
   case Label::PairUp:
     return "PairUp";
+  case Label::Tuple:
+    return "Tuple";
+  case Label::Vec:
+    return "Vec";
+  case Label::Prim:
+    return "Prim";
   case Label::Seq:
     return "Seq";
   case Label::Var:
@@ -521,5 +648,9 @@ std::string label_to_string(Label l)
     return "Unit";
   case Label::String:
     return "String";
+  case Label::UseFile:
+    return "UseFile";
+  case Label::Program:
+    return "Program";
   }
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include "tokenstream.h"
+#include <atomic>
 #include <iostream>
+#include <memory>
 
 enum Label {
   If,
@@ -15,6 +17,7 @@ enum Label {
   Equals,
   Plus,
   Minus,
+  Concat,
   Times,
   Div,
   Mod,
@@ -23,18 +26,36 @@ enum Label {
   Print,
   First,
   Second,
+  Select,
   Literal,
   PairUp,
+  Tuple,
+  Vec,
+  Prim,
   Seq,
   Var,
   Unit,
   Int,
   Bool,
   String,
+  UseFile,
+  Program,
 };
 
 std::string label_to_string(Label l);
 
+// Special: the faster form a node has rewritten itself into after watching
+// the values it was evaluated with (eval.cc). A node whose guard fails goes
+// back to Generic for good.
+enum class Special : unsigned char {
+  Unseen,   // not evaluated yet
+  Generic,  // the checks in eval's main switch
+  IntInt,   // arithmetic or comparison of two ints
+  IntConst, // the same with an int literal on the right
+  Call,     // application of a closure
+  Curried,  // the outermost App of f a1 ... an (evalCurried)
+};
+
 class AstNode {
     public:
   virtual bool is_branch() { return false; }
@@ -71,7 +92,7 @@ class AstLeaf : public AstNode {
 class AstString : public AstNode {
     public:
   bool is_string() override { return true; }
-  std::string get_string() { return _string; }
+  std::string const &get_string() { return _string; }
   void set_string(std::string s) { _string = s; }
   std::string to_string() override { return "\"" + _string + "\""; }
   static std::shared_ptr<AstString> New(std::string s)
@@ -94,11 +115,22 @@ class AstBranch : public AstNode {
   std::string where(void);
   bool is_branch() override { return true; }
   void where(std::string whr);
+  std::shared_ptr<class JitGroup> jit(void) { return _jit; }
+  void jit(std::shared_ptr<class JitGroup> group) { _jit = group; }
+  bool fork(void) { return _fork; }
+  void fork(bool f) { _fork = f; }
+  bool captures(void) { return _captures; }
+  void captures(bool c) { _captures = c; }
+  Special special(void) { return _special.load(std::memory_order_acquire); }
+  void special(Special s) { _special.store(s, std::memory_order_release); }
+  int constant(void) { return _constant; } // the literal of IntConst
+  void constant(int n) { _constant = n; }  // set before special(IntConst)
   void add(std::shared_ptr<AstNode> node); // ads any AstNode subclass
   void add(std::string str);               // adds a string
   void add(Label label, int val);          // adds a leaf
 
   std::shared_ptr<AstNode> get(int n);
+  void set(int n, std::shared_ptr<AstNode> node); // replaces a child
   int count(void);
 
   // for diagnosis
@@ -107,23 +139,24 @@ class AstBranch : public AstNode {
     private:
   std::vector<std::shared_ptr<class AstNode>> args;
   std::string _where;
+  std::shared_ptr<class JitGroup> _jit; // native code for Fun/Funs nodes
+  bool _fork{false}; // PairUp components may be evaluated in parallel
+  bool _captures{true}; // may make a closure, so keeps its environment
+  std::atomic<Special> _special{Special::Unseen}; // nodes are shared by threads
+  int _constant{0};
 };
 
 class SMLParser {
     public:
-  SMLParser(TokenStream *tokens)
-  {
-    BINOPS = {"andalso", "orelse", "<", "=", "+", "-", "*", "div", "mod"};
-    STOPPERS = {"then", "else", "in", "and", "end", ")", ";", ",", "eof"};
-    STOPPERS.insert(STOPPERS.end(), BINOPS.begin(), BINOPS.end());
-    MULTOPPS = {"*", "div", "mod"};
-    ADDNOPPS = {"+", "-"};
-    tks = tokens;
-  }
+  SMLParser(TokenStream *tokens) { tks = tokens; }
   std::shared_ptr<AstBranch> operator()() { return parseExpn(); }
+  std::shared_ptr<AstBranch> program(void);
+  std::shared_ptr<AstBranch> item(void);
 
     private:
   std::shared_ptr<AstBranch> parseExpn(void);
+  std::shared_ptr<AstBranch> parseDecl(void);
+  std::shared_ptr<AstBranch> parseUse(void);
   std::shared_ptr<AstBranch> parseDisj(void);
   std::shared_ptr<AstBranch> parseConj(void);
   std::shared_ptr<AstBranch> parseCmpn(void);
@@ -132,9 +165,10 @@ class SMLParser {
   std::shared_ptr<AstBranch> parseAppl(void);
   std::shared_ptr<AstBranch> parsePrfx(void);
   std::shared_ptr<AstBranch> parseAtom(void);
-  std::vector<std::string> BINOPS;
-  std::vector<std::string> STOPPERS;
-  std::vector<std::string> MULTOPPS;
-  std::vector<std::string> ADDNOPPS;
+  // shared by every parser rather than rebuilt for each one
+  static const std::vector<std::string> BINOPS;
+  static const std::vector<std::string> STOPPERS;
+  static const std::vector<std::string> MULTOPPS;
+  static const std::vector<std::string> ADDNOPPS;
   TokenStream *tks;
 };
@@ -0,0 +1,148 @@
+#include "slab.h"
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <mutex>
+
+static const int KINDS = static_cast<int>(SlabKind::Count);
+static const char *KIND_NAMES[KINDS] = {"Int",  "Bool",  "Pair",
+                                         "Clos", "Frame", "String"};
+
+// SizeClass: one thread's blocks of one kind. Only the owning thread
+// writes the counters; slabStats reads them from anywhere.
+struct SizeClass {
+  void *free{nullptr}; // each free block starts with the next one
+  char *bump{nullptr};
+  char *end{nullptr};
+  std::atomic<size_t> size{0};
+  std::atomic<long> live{0}; // may go negative: blocks move between threads
+  std::atomic<size_t> slabs{0};
+};
+
+struct ThreadSlabs {
+  SizeClass kinds[KINDS];
+  long held{0}; // outside the slabs, see countBytes
+};
+
+// Slabs outlive their threads, since the objects in them may. A thread
+// that exits leaves its classes, free lists included, to the next one.
+// The registry is never destroyed either: static objects (the default
+// EvalContext, say) still free values while the others are torn down.
+struct Registry {
+  std::mutex lock;
+  std::vector<ThreadSlabs *> all;
+  std::vector<ThreadSlabs *> spare;
+};
+
+static Registry &registry(void)
+{
+  static Registry *r = new Registry;
+  return *r;
+}
+
+static thread_local ThreadSlabs *mine = nullptr;
+
+struct SlabReturn {
+  ~SlabReturn()
+  {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.spare.push_back(mine);
+    mine = nullptr; // anything freed later takes classes of its own
+  }
+};
+
+static SizeClass &sizeClass(SlabKind kind)
+{
+  if (!mine) {
+    {
+      Registry &r = registry();
+      std::lock_guard<std::mutex> guard(r.lock);
+      if (r.spare.size()) {
+        mine = r.spare.back();
+        r.spare.pop_back();
+      }
+      else {
+        mine = new ThreadSlabs;
+        r.all.push_back(mine);
+      }
+    }
+    static thread_local SlabReturn give_back;
+    (void)give_back;
+  }
+  return mine->kinds[static_cast<int>(kind)];
+}
+
+// single writer, so no read-modify-write is needed
+template <typename T> static void bump(std::atomic<T> &n, int by)
+{
+  n.store(n.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+void *slabAllocate(SlabKind kind, size_t size)
+{
+  SizeClass &c = sizeClass(kind);
+  size = (size + 15) & ~size_t(15);
+  assert(size <= SLAB_BYTES);
+  if (!c.size) c.size.store(size, std::memory_order_relaxed);
+  assert(c.size == size);
+  bump(c.live, 1);
+  if (c.free) {
+    void *block = c.free;
+    c.free = *static_cast<void **>(block);
+    return block;
+  }
+  if (c.end - c.bump < static_cast<ptrdiff_t>(size)) {
+    c.bump = static_cast<char *>(aligned_alloc(16, SLAB_BYTES));
+    if (!c.bump) throw std::bad_alloc();
+    c.end = c.bump + SLAB_BYTES;
+    bump(c.slabs, 1);
+  }
+  void *block = c.bump;
+  c.bump += size;
+  return block;
+}
+
+void slabFree(SlabKind kind, void *block)
+{
+  SizeClass &c = sizeClass(kind);
+  *static_cast<void **>(block) = c.free;
+  c.free = block;
+  bump(c.live, -1);
+}
+
+void countBytes(long by)
+{
+  sizeClass(SlabKind::Int); // makes mine
+  mine->held += by;
+}
+
+long threadBytes(void)
+{
+  sizeClass(SlabKind::Int);
+  long bytes = mine->held;
+  for (SizeClass &c : mine->kinds)
+    bytes += c.live.load(std::memory_order_relaxed) *
+             long(c.size.load(std::memory_order_relaxed));
+  return bytes;
+}
+
+std::vector<SlabStats> slabStats(void)
+{
+  std::vector<SlabStats> out(KINDS);
+  Registry &r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  for (int k = 0; k < KINDS; k++) {
+    long live = 0;
+    size_t size = 0;
+    out[k].name = KIND_NAMES[k];
+    for (ThreadSlabs *t : r.all) {
+      live += t->kinds[k].live.load(std::memory_order_relaxed);
+      out[k].slabs += t->kinds[k].slabs.load(std::memory_order_relaxed);
+      size = std::max(size, t->kinds[k].size.load(std::memory_order_relaxed));
+    }
+    out[k].live = live;
+    out[k].bytes = live * size;
+  }
+  return out;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Bytes carved up by each size class at a time
+const size_t SLAB_BYTES = 64 * 1024;
+
+enum class SlabKind { Int, Bool, Pair, Clos, Frame, String, Count };
+
+// slabAllocate: A block for one object of a kind, popped off the calling
+// thread's free list or bumped out of its current slab. Every block of a
+// kind has the same size.
+void *slabAllocate(SlabKind kind, size_t size);
+
+// slabFree: Pushes a block onto the calling thread's free list for its kind
+void slabFree(SlabKind kind, void *block);
+
+// countBytes: Counts memory a value holds outside the slabs, such as a
+// vector's elements, against the calling thread; negative when let go
+void countBytes(long by);
+
+// threadBytes: Bytes held by the values the calling thread allocated, less
+// those it freed, which may have come from other threads
+long threadBytes(void);
+
+struct SlabStats {
+  std::string name;
+  size_t live{0};  // objects
+  size_t bytes{0}; // held by live objects, control blocks included
+  size_t slabs{0}; // SLAB_BYTES each
+};
+
+std::vector<SlabStats> slabStats(void); // one entry per kind
+
+// SlabAllocator: lets std::allocate_shared place a value and its reference
+// count in one slab block, e.g.
+//   std::allocate_shared<T>(SlabAllocator<T>(SlabKind::Int), ...)
+template <typename T> struct SlabAllocator {
+  using value_type = T;
+  SlabKind kind;
+  SlabAllocator(SlabKind k) : kind(k) {}
+  template <typename U> SlabAllocator(SlabAllocator<U> const &a) : kind(a.kind)
+  {
+  }
+  T *allocate(size_t n)
+  {
+    return static_cast<T *>(slabAllocate(kind, n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t) { slabFree(kind, p); }
+  template <typename U> bool operator==(SlabAllocator<U> const &a) const
+  {
+    return kind == a.kind;
+  }
+  template <typename U> bool operator!=(SlabAllocator<U> const &a) const
+  {
+    return kind != a.kind;
+  }
+};
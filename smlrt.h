@@ -0,0 +1,479 @@
+#pragma once
+// smlrt.h: the runtime linked into programs written by `MiniML --emit-cpp`.
+// It mirrors the interpreter's values (eval.h) closely enough that a
+// compiled program prints exactly what the interpreter would.
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace smlrt {
+
+enum class Tag { Int, Bool, Unit, Pair, Clos, Tuple, Vector, String };
+
+struct Obj {
+  virtual ~Obj() {}
+};
+
+struct Value {
+  Tag tag{Tag::Unit};
+  int i{0};
+  std::shared_ptr<Obj> o;
+};
+
+struct Pair : Obj {
+  Value first;
+  Value last;
+};
+
+struct Tuple : Obj {
+  std::vector<Value> fields;
+};
+
+struct Vector : Obj {
+  std::vector<int> ints;
+};
+
+struct Text : Obj {
+  std::string s;
+};
+
+struct Clos : Obj {
+  std::function<Value(Value)> fn;
+  std::string text; // what SMLClos::to_string would show
+};
+
+// Operands are gathered in braced lists, which C++ evaluates left to right,
+// and each is checked as soon as it is computed, just like eval does.
+struct Two {
+  Value l;
+  Value r;
+};
+
+struct Ints {
+  int l;
+  int r;
+};
+
+struct Call {
+  std::shared_ptr<Clos> f;
+  Value x;
+};
+
+class Error : public std::exception {
+    public:
+  Error(std::string error_msg) { msg = error_msg; }
+  std::string what() { return msg; }
+
+    protected:
+  std::string msg;
+};
+
+inline Value Int(int n) { return Value{Tag::Int, n, nullptr}; }
+inline Value Bool(bool b) { return Value{Tag::Bool, b, nullptr}; }
+inline Value Unit(void) { return Value{}; }
+
+inline Value pair(Two v)
+{
+  std::shared_ptr<Pair> p = std::make_shared<Pair>();
+  p->first = v.l;
+  p->last = v.r;
+  return Value{Tag::Pair, 0, p};
+}
+
+inline Value tuple(std::vector<Value> fields)
+{
+  std::shared_ptr<Tuple> t = std::make_shared<Tuple>();
+  t->fields = fields;
+  return Value{Tag::Tuple, 0, t};
+}
+
+inline Value closure(std::string text)
+{
+  std::shared_ptr<Clos> c = std::make_shared<Clos>();
+  c->text = text;
+  return Value{Tag::Clos, 0, c};
+}
+
+inline void define(Value c, std::function<Value(Value)> fn)
+{
+  static_cast<Clos *>(c.o.get())->fn = fn;
+}
+
+inline Value lambda(std::string text, std::function<Value(Value)> fn)
+{
+  Value c = closure(text);
+  define(c, fn);
+  return c;
+}
+
+inline std::string type(Value v)
+{
+  switch (v.tag) {
+  case Tag::Int:
+    return "Int";
+  case Tag::Bool:
+    return "Bool";
+  case Tag::Unit:
+    return "Unit";
+  case Tag::Pair:
+    return "PairUp";
+  case Tag::Clos:
+    return "Clos";
+  case Tag::Tuple:
+    return "Tuple";
+  case Tag::Vector:
+    return "Vector";
+  case Tag::String:
+    return "String";
+  }
+  return "Uninitialized";
+}
+
+inline std::string to_string(Value v)
+{
+  switch (v.tag) {
+  case Tag::Int:
+    return std::to_string(v.i);
+  case Tag::Bool:
+    return v.i ? "true" : "false";
+  case Tag::Unit:
+    return "()";
+  case Tag::Pair: {
+    Pair *p = static_cast<Pair *>(v.o.get());
+    return "(" + to_string(p->first) + "," + to_string(p->last) + ")";
+  }
+  case Tag::Clos:
+    return static_cast<Clos *>(v.o.get())->text;
+  case Tag::Tuple: {
+    std::string out = "(";
+    for (Value &f : static_cast<Tuple *>(v.o.get())->fields)
+      out += (out.size() > 1 ? "," : "") + to_string(f);
+    return out + ")";
+  }
+  case Tag::Vector: {
+    std::string out = "[";
+    for (int n : static_cast<Vector *>(v.o.get())->ints)
+      out += (out.size() > 1 ? "," : "") + std::to_string(n);
+    return out + "]";
+  }
+  case Tag::String:
+    return static_cast<Text *>(v.o.get())->s;
+  }
+  return "(SMLValue)";
+}
+
+inline std::string to_string_typed(Value v)
+{
+  if (v.tag == Tag::Pair) {
+    Pair *p = static_cast<Pair *>(v.o.get());
+    return "[Pair, (" + to_string_typed(p->first) + ", " +
+           to_string_typed(p->last) + ")]";
+  }
+  if (v.tag == Tag::Tuple) {
+    std::string out = "[Tuple, (";
+    for (Value &f : static_cast<Tuple *>(v.o.get())->fields)
+      out += (out.size() > 9 ? ", " : "") + to_string_typed(f);
+    return out + ")]";
+  }
+  if (v.tag == Tag::String) return "[String, \"" + to_string(v) + "\"]";
+  return "[" + type(v) + ", " + to_string(v) + "]";
+}
+
+inline bool truthy(Value v)
+{
+  if (v.tag != Tag::Bool) throw Error("Bad Bool cast " + to_string(v));
+  return v.i;
+}
+
+inline Value boolean(Value v) { return Bool(truthy(v)); }
+
+inline int integer(Value v, std::string msg)
+{
+  if (v.tag != Tag::Int) throw Error(msg);
+  return v.i;
+}
+
+inline std::shared_ptr<Clos> callee(Value v)
+{
+  if (v.tag != Tag::Clos)
+    throw Error("Bad Clos cast: tried to cast type " + type(v));
+  return std::static_pointer_cast<Clos>(v.o);
+}
+
+inline Value apply(Call c) { return c.f->fn(c.x); }
+
+inline Value first(Value v, std::string msg)
+{
+  if (v.tag != Tag::Pair) throw Error("Bad Pair Cast: " + msg);
+  return static_cast<Pair *>(v.o.get())->first;
+}
+
+inline Value second(Value v, std::string msg)
+{
+  if (v.tag != Tag::Pair) throw Error("Bad Pair Cast: " + msg);
+  return static_cast<Pair *>(v.o.get())->last;
+}
+
+// select: #k of a tuple, or of a pair for k = 1, 2
+inline Value select(Value v, int k, std::string where)
+{
+  if (v.tag == Tag::Tuple &&
+      k <= int(static_cast<Tuple *>(v.o.get())->fields.size()))
+    return static_cast<Tuple *>(v.o.get())->fields[k - 1];
+  if (v.tag == Tag::Pair && k <= 2)
+    return k == 1 ? static_cast<Pair *>(v.o.get())->first
+                  : static_cast<Pair *>(v.o.get())->last;
+  throw Error("Attempted to select field #" + std::to_string(k) + " of " +
+              to_string_typed(v) + " at " + where + ".");
+}
+
+inline Value text(std::string s)
+{
+  std::shared_ptr<Text> t = std::make_shared<Text>();
+  t->s = s;
+  return Value{Tag::String, 0, t};
+}
+
+// join: `^`, which checks its left operand before evaluating the right
+inline Value join1(Value v, std::string where)
+{
+  if (v.tag != Tag::String)
+    throw Error("Attempted to join " + to_string_typed(v) + " with ^ at " +
+                where + ".");
+  return v;
+}
+
+inline Value join(Two v, std::string where)
+{
+  join1(v.r, where);
+  return text(static_cast<Text *>(v.l.o.get())->s +
+              static_cast<Text *>(v.r.o.get())->s);
+}
+
+inline Value vector(std::vector<int> ints)
+{
+  std::shared_ptr<Vector> v = std::make_shared<Vector>();
+  v->ints = ints;
+  return Value{Tag::Vector, 0, v};
+}
+
+// element: one element of a vector literal
+inline int element(Value v, std::string where)
+{
+  return integer(v, "Vector elements are ints, saw " + to_string_typed(v) +
+                        " at " + where + ".");
+}
+
+// builtin: Vector.length and the rest (builtin.h), one element at a time
+inline Value builtin(int b, Value arg, std::string where)
+{
+  static const char *names[] = {
+      "Vector.length",    "Vector.sub",         "Vector.tabulate",
+      "Vector.map",       "Vector.foldl",       "Vector.filter",
+      "String.size",      "String.sub",         "String.substring",
+      "String.isSubstring", "String.str"};
+  static const char *what[] = {"a vector",
+                               "(vector, int)",
+                               "(int, function)",
+                               "(function, vector)",
+                               "(function, value, vector)",
+                               "(function, vector)",
+                               "a string",
+                               "(string, int)",
+                               "(string, int, int)",
+                               "(string, string)",
+                               "an int"};
+  static const int arity[] = {1, 2, 2, 2, 3, 2, 1, 2, 3, 2, 1};
+  std::string name = names[b];
+  auto expected = [&](Value v) {
+    return Error(name + " expects " + what[b] + ", got " + to_string_typed(v) +
+                 " at " + where + ".");
+  };
+  auto error = [&](std::string what) {
+    return Error(name + ": " + what + " at " + where + ".");
+  };
+  std::vector<Value> a;
+  if (arity[b] == 1)
+    a = {arg};
+  else if (arity[b] == 2 && arg.tag == Tag::Pair)
+    a = {static_cast<Pair *>(arg.o.get())->first,
+         static_cast<Pair *>(arg.o.get())->last};
+  else if (arg.tag == Tag::Tuple &&
+           int(static_cast<Tuple *>(arg.o.get())->fields.size()) == arity[b])
+    a = static_cast<Tuple *>(arg.o.get())->fields;
+  else
+    throw expected(arg);
+  auto ints = [&](Value v) -> std::vector<int> & {
+    if (v.tag != Tag::Vector) throw expected(v);
+    return static_cast<Vector *>(v.o.get())->ints;
+  };
+  auto str = [&](Value v) -> std::string & {
+    if (v.tag != Tag::String) throw expected(v);
+    return static_cast<Text *>(v.o.get())->s;
+  };
+  auto num = [&](Value v) {
+    if (v.tag != Tag::Int) throw expected(v);
+    return v.i;
+  };
+  auto fn = [&](Value v) {
+    if (v.tag != Tag::Clos) throw expected(v);
+    return std::static_pointer_cast<Clos>(v.o);
+  };
+  auto result = [&](Value v) {
+    if (v.tag != Tag::Int)
+      throw error("the function returned " + to_string_typed(v) +
+                  ", not an int,");
+    return v.i;
+  };
+  std::vector<int> out;
+  switch (b) {
+  case 0:
+    return Int(ints(a[0]).size());
+  case 1: {
+    std::vector<int> &v = ints(a[0]);
+    int i = num(a[1]);
+    if (i < 0 || size_t(i) >= v.size())
+      throw error("index " + std::to_string(i) + " out of range for length " +
+                  std::to_string(v.size()));
+    return Int(v[i]);
+  }
+  case 2: {
+    int n = num(a[0]);
+    std::shared_ptr<Clos> f = fn(a[1]);
+    if (n < 0) throw error("negative length " + std::to_string(n));
+    for (int i = 0; i < n; i++)
+      out.push_back(result(f->fn(Int(i))));
+    return vector(out);
+  }
+  case 3: {
+    std::shared_ptr<Clos> f = fn(a[0]);
+    for (int x : ints(a[1]))
+      out.push_back(result(f->fn(Int(x))));
+    return vector(out);
+  }
+  case 4: {
+    std::shared_ptr<Clos> f = fn(a[0]);
+    std::vector<int> &v = ints(a[2]);
+    Value acc = a[1];
+    for (int x : v)
+      acc = f->fn(pair(Two{Int(x), acc}));
+    return acc;
+  }
+  case 5: {
+    std::shared_ptr<Clos> f = fn(a[0]);
+    for (int x : ints(a[1]))
+      if (truthy(f->fn(Int(x)))) out.push_back(x);
+    return vector(out);
+  }
+  case 6:
+    return Int(str(a[0]).size());
+  case 7: {
+    std::string &s = str(a[0]);
+    int i = num(a[1]);
+    if (i < 0 || size_t(i) >= s.size())
+      throw error("index " + std::to_string(i) + " out of range for size " +
+                  std::to_string(s.size()));
+    return Int(static_cast<unsigned char>(s[i]));
+  }
+  case 8: {
+    std::string &s = str(a[0]);
+    int i = num(a[1]), len = num(a[2]);
+    if (i < 0 || len < 0 || size_t(i) + size_t(len) > s.size())
+      throw error("(" + std::to_string(i) + ", " + std::to_string(len) +
+                  ") out of range for size " + std::to_string(s.size()));
+    return text(s.substr(i, len));
+  }
+  case 9: {
+    std::string &needle = str(a[0]);
+    return Bool(str(a[1]).find(needle) != std::string::npos);
+  }
+  default: {
+    int c = num(a[0]);
+    if (c < 0 || c > 255)
+      throw error(std::to_string(c) + " is not a character code");
+    return text(std::string(1, static_cast<char>(c)));
+  }
+  }
+}
+
+inline Value print(Value v)
+{
+  std::cout << to_string(v) + "\n";
+  return Unit();
+}
+
+inline Value unbound(std::string x)
+{
+  throw Error("Use of variable '" + x + "'. ");
+}
+
+// operands of the arithmetic and comparison operators, with eval's messages
+inline int arith1(Value v)
+{
+  return integer(v, "INTOPS v1: " + to_string_typed(v));
+}
+inline int arith2(Value v)
+{
+  return integer(v, "INTOPS v2: " + to_string_typed(v));
+}
+inline int cmp1(Value v) { return integer(v, "CMPOPS v1: "); }
+inline int cmp2(Value v) { return integer(v, "CMPOPS v2: "); }
+
+inline Value plus(Ints v) { return Int(v.l + v.r); }
+inline Value minus(Ints v) { return Int(v.l - v.r); }
+inline Value times(Ints v) { return Int(v.l * v.r); }
+
+// div and mod: as intop in eval.cc, an error on a zero divisor, and the
+// least int over -1 wraps rather than trapping
+inline Value div(Ints v, std::string const &where)
+{
+  if (v.r == 0) throw Error("Division by zero at " + where + ".");
+  if (v.r == -1) return Int(0u - unsigned(v.l));
+  return Int(v.l / v.r);
+}
+inline Value mod(Ints v, std::string const &where)
+{
+  if (v.r == 0) throw Error("Division by zero at " + where + ".");
+  if (v.r == -1) return Int(0);
+  return Int(v.l % v.r);
+}
+
+inline Value less(Ints v) { return Bool(v.l < v.r); }
+inline Value equals(Ints v) { return Bool(v.l == v.r); }
+
+// `=` also compares strings, so its left operand is checked for either
+inline Value eq1(Value v)
+{
+  if (v.tag != Tag::Int && v.tag != Tag::String) throw Error("CMPOPS v1: ");
+  return v;
+}
+
+inline Value equal(Two v)
+{
+  if (v.l.tag != v.r.tag) throw Error("CMPOPS v2: ");
+  if (v.l.tag == Tag::Int) return Bool(v.l.i == v.r.i);
+  return Bool(static_cast<Text *>(v.l.o.get())->s ==
+              static_cast<Text *>(v.r.o.get())->s);
+}
+
+// show: what `MiniML prog.sml` does with the value of a top-level expression
+inline void show(Value v)
+{
+  std::cout << "Out: " << to_string_typed(v) << "\n";
+}
+
+inline int run(std::function<void(void)> program)
+{
+  try {
+    program();
+  }
+  catch (Error err) {
+    std::cout << "\nError caught:\n";
+    std::cout << err.what() << "\n";
+  }
+  return 0;
+}
+
+} // namespace smlrt
@@ -0,0 +1,133 @@
+// The string builtins, and the kernels that compare and search text
+#include "text.h"
+#include "builtin.h"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SML_SIMD_SUPPORTED 1
+#else
+#define SML_SIMD_SUPPORTED 0
+#endif
+
+#if SML_SIMD_SUPPORTED
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static __m256i load32(const char *p)
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+AVX2 static bool sameAvx2(const char *a, const char *b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(load32(a + i), load32(b + i))) !=
+        -1)
+      return false;
+  return !memcmp(a + i, b + i, n - i);
+}
+
+// findAvx2: for 1 <= m <= n
+AVX2 static size_t findAvx2(const char *h, size_t n, const char *p, size_t m)
+{
+  __m256i first = _mm256_set1_epi8(p[0]);
+  __m256i last = _mm256_set1_epi8(p[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(load32(h + i), first),
+                         _mm256_cmpeq_epi8(load32(h + i + m - 1), last)));
+    for (; mask; mask &= mask - 1) {
+      int at = __builtin_ctz(mask);
+      if (!memcmp(h + i + at, p, m)) return i + at;
+    }
+  }
+  size_t r = std::string_view(h + i, n - i).find(std::string_view(p, m));
+  return r == std::string_view::npos ? r : i + r;
+}
+#endif
+
+bool sameText(std::string_view a, std::string_view b)
+{
+  if (a.size() != b.size()) return false;
+#if SML_SIMD_SUPPORTED
+  if (useAvx2()) return sameAvx2(a.data(), b.data(), a.size());
+#endif
+  return !memcmp(a.data(), b.data(), a.size());
+}
+
+size_t findText(std::string_view haystack, std::string_view needle)
+{
+  if (needle.empty()) return 0;
+  if (needle.size() > haystack.size()) return std::string_view::npos;
+#if SML_SIMD_SUPPORTED
+  if (useAvx2())
+    return findAvx2(haystack.data(), haystack.size(), needle.data(),
+                    needle.size());
+#endif
+  return haystack.find(needle);
+}
+
+// Character codes and one-char strings are made once and never freed, so
+// String.sub and String.str allocate nothing
+static std::shared_ptr<SMLInt> code(unsigned char c)
+{
+  static std::shared_ptr<SMLInt> *codes = [] {
+    std::shared_ptr<SMLInt> *out = new std::shared_ptr<SMLInt>[256];
+    for (int c = 0; c < 256; c++)
+      out[c] = SMLInt::New(c);
+    return out;
+  }();
+  return codes[c];
+}
+
+static std::shared_ptr<SMLString> character(unsigned char c)
+{
+  static std::shared_ptr<SMLString> *chars = [] {
+    std::shared_ptr<SMLString> *out = new std::shared_ptr<SMLString>[256];
+    for (int c = 0; c < 256; c++) {
+      char s = static_cast<char>(c);
+      out[c] = SMLString::New(std::string_view(&s, 1));
+    }
+    return out;
+  }();
+  return chars[c];
+}
+
+std::shared_ptr<SMLValue> textBuiltin(BuiltinCall &call)
+{
+  switch (call.builtin) {
+  case Builtin::Size:
+    return SMLInt::New(call.text(0)->size());
+  case Builtin::CharAt: {
+    std::shared_ptr<SMLString> s = call.text(0);
+    int i = call.integer(1);
+    if (i < 0 || size_t(i) >= s->size())
+      throw call.error("index " + std::to_string(i) +
+                       " out of range for size " + std::to_string(s->size()));
+    return code(s->view()[i]);
+  }
+  case Builtin::Substring: {
+    std::shared_ptr<SMLString> s = call.text(0);
+    int i = call.integer(1), len = call.integer(2);
+    if (i < 0 || len < 0 || size_t(i) + size_t(len) > s->size())
+      throw call.error("(" + std::to_string(i) + ", " + std::to_string(len) +
+                       ") out of range for size " +
+                       std::to_string(s->size()));
+    return s->slice(i, len);
+  }
+  case Builtin::IsSubstring: {
+    std::shared_ptr<SMLString> needle = call.text(0);
+    std::shared_ptr<SMLString> haystack = call.text(1);
+    return SMLBool::New(findText(haystack->view(), needle->view()) !=
+                        std::string_view::npos);
+  }
+  default: { // Str
+    int c = call.integer(0);
+    if (c < 0 || c > 255)
+      throw call.error(std::to_string(c) + " is not a character code");
+    return character(c);
+  }
+  }
+}
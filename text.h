@@ -0,0 +1,11 @@
+#pragma once
+#include <string_view>
+
+// sameText: Whether a and b hold the same chars, compared 32 at a time with
+// AVX2 where the CPU has it
+bool sameText(std::string_view a, std::string_view b);
+
+// findText: Where needle first occurs in haystack, or npos. With AVX2 the
+// candidates are the positions matching needle's first and last chars,
+// found 32 at a time.
+size_t findText(std::string_view haystack, std::string_view needle);
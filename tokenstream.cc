@@ -1,4 +1,13 @@
 #include "tokenstream.h"
+#include <stdexcept>
+
+const vector<string> TokenStream::RESERVED = {
+    "if",     "then",    "else", "let", "val",  "fun",   "and",
+    "in",     "end",     "fn",   "div", "mod",  "true",  "false",
+    "orelse", "andalso", "print", "fst", "snd", "use", "eof"};
+const string TokenStream::DELIMITERS = "();,|[]";
+const string TokenStream::OPERATORS = "+-*/<>=&!:.^";
+const string TokenStream::WHITESPACE = " \t\n\r";
 
 void TokenStream::lexassert(bool assertion)
 {
@@ -33,7 +42,7 @@ token TokenStream::advance(void)
 {
   token temp = next();
   if (tokens.size() > 0) tokens.pop_front();
-  if (starts.size() > 0) starts.pop_back();
+  if (starts.size() > 0) starts.pop_front();
   return temp;
 }
 
@@ -41,8 +50,8 @@ string TokenStream::report(void)
 {
   string s;
   s += source_name;
-  s += " line " + to_string(starts.back().line_number);
-  s += " column " + to_string(starts.back().column_number);
+  s += " line " + to_string(starts.front().line_number);
+  s += " column " + to_string(starts.front().column_number);
   return s;
 }
 
@@ -63,9 +72,14 @@ int TokenStream::eatInt(void)
 {
   if (nextIsInt()) {
     // This should handle converting positive and negative ints
+    string where = report();
     string tmp = advance();
-    int stoi = std::stoi(tmp);
-    return stoi;
+    try {
+      return std::stoi(tmp);
+    }
+    catch (std::out_of_range &) {
+      throw SyntaxError("Integer literal out of range at " + where + ".");
+    }
   }
   else {
     string err = "Unexpected token at " + report() + ". ";
@@ -132,7 +146,7 @@ bool TokenStream::nextIsString(void)
 
 void TokenStream::initIssue(void) { markIssue(); }
 
-void TokenStream::markIssue(void) { mark = Position{line, column}; }
+void TokenStream::markIssue(void) { mark = Position{line, column, offset}; }
 
 // TokenStream::issue: Issues a new token to tokens
 //
@@ -155,7 +169,7 @@ char TokenStream::nxt(int lookahead = 0) { return source->peek(lookahead); }
 
 void TokenStream::chompSelector(void)
 {
-  lexassert(nxt() == '#' || isdigit(nxt(2)), "chompSelector");
+  lexassert(nxt() == '#' && isdigit(nxt(1)), "chompSelector");
   chompChar();
   string tk = "#";
   while (isdigit(nxt()))
@@ -163,7 +177,8 @@ void TokenStream::chompSelector(void)
   issue(tk);
 }
 
-// TokenStream::chompWord: Eats a word into a token
+// TokenStream::chompWord: Eats a word into a token, keeping a qualified
+// name such as Vector.map whole
 
 void TokenStream::chompWord(void)
 {
@@ -172,6 +187,11 @@ void TokenStream::chompWord(void)
   tk += chompChar();
   while (isalnum(nxt()))
     tk += chompChar();
+  while (nxt() == '.' && isalpha(nxt(1))) {
+    tk += chompChar();
+    while (isalnum(nxt()))
+      tk += chompChar();
+  }
   issue(tk);
 }
 
@@ -242,8 +262,12 @@ void TokenStream::chompComment(void)
   char c;
   lexassert((c = chompChar()) == '(', "chompComment");
   lexassert((c = chompChar()) == '*', "chompComment");
+  // line breaks count, but the comment stays part of the next token's run-up
   while (source->gcount() >= 2 && !(source->expose_next(2) == "*)"))
-    chompChar();
+    if (WHITESPACE.find(nxt()) != -1)
+      chompWhitespace(true);
+    else
+      chompChar();
   if (source->gcount() < 2)
     raiseLex("EOF encountered within comment");
   else {
@@ -270,6 +294,7 @@ char TokenStream::chompChar(void)
   lexassert(source->peek() != EOF, "chompChar");
   char c = source->get();
   column++;
+  offset++;
   return c;
 }
 
@@ -281,6 +306,7 @@ void TokenStream::chompWhitespace(bool withintoken)
 {
   lexassert(source->peek() != EOF, "chompWhitespace");
   char c = source->get();
+  offset++;
   if (c == ' ')
     column++;
   else if (c == '\t')
@@ -319,6 +345,9 @@ void TokenStream::analyze(void)
     // CHOMP an integer literal
     else if (isdigit(nxt()))
       chompInt();
+    // CHOMP a tuple selector
+    else if (nxt() == '#' && isdigit(nxt(1)))
+      chompSelector();
     // CHOMP a single "delimiter" char
     else if (DELIMITERS.find(nxt()) != -1)
       issue(char_string(chompChar()));
@@ -331,18 +360,6 @@ void TokenStream::analyze(void)
   }
 }
 
-// in_vector: Tests if an object is in a vector
-//
-// vector<T> vec: Vector type
-// T obj: obj to test
-//
-// return template <typename T> int: position of object, -1 if not found
-
-template <typename T> bool in_vector(vector<T> &vec, T obj)
-{
-  return std::find(vec.begin(), vec.end(), obj) != vec.end();
-}
-
 // char_string: converts a char to a string correctly
 //
 // char c: the char
@@ -12,11 +12,22 @@ using std::vector;
 using token = std::string;
 using std::to_string;
 
-template <typename T> bool in_vector(vector<T> &vec, T obj);
+// in_vector: Tests if an object is in a vector
+//
+// vector<T> vec: Vector type
+// T obj: obj to test
+//
+// return template <typename T> int: position of object, -1 if not found
+
+template <typename T> bool in_vector(const vector<T> &vec, T obj)
+{
+  return std::find(vec.begin(), vec.end(), obj) != vec.end();
+}
 
 struct Position {
   int line_number;
   int column_number;
+  int offset; // bytes from the start of the source
 };
 
 class TokenStream {
@@ -27,6 +38,14 @@ class TokenStream {
     source = source_;
     analyze();
   }
+  // over tokens lexed already, each with the position it starts at
+  TokenStream(string sourcename, list<token> tokens_, list<Position> starts_)
+  {
+    source_name = sourcename;
+    source = nullptr;
+    tokens = tokens_;
+    starts = starts_;
+  }
   // The Tokenizer itself
   void analyze(void);
   token next(void);    // returns the token at the front, doesn't change state
@@ -36,24 +55,24 @@ class TokenStream {
   int eatInt(void);    // eats the next token if it's an integer, else error
   token eatName(void); // eats the next token if it's a name, else error
   token eatString(void); // eats next token if string, else error
-  vector<string> RESERVED = {"if",     "then",    "else", "let", "val",
-                             "fun",    "and",     "in",   "end", "fn",
-                             "orelse", "andalso", "div",  "mod", "true",
-                             "false",  "print",   "fst",  "snd", "eof"};
+  static const vector<string> RESERVED;
   bool nextIsInt(void);    // Checks if next token is an integer literal token.
   bool nextIsName(void);   // Checks if next token is a name.
   bool nextIsString(void); // Checks if next token is a string literal.
 
   void checkEOF(void); // Checks if the next token indicates end of file
+  int remaining(void) { return tokens.size(); } // tokens not consumed yet
+  list<token> const &lexed(void) { return tokens; }
+  list<Position> const &positions(void) { return starts; }
 
   // Characters that separate expressions.
-  string DELIMITERS = "();,|";
+  static const string DELIMITERS;
 
   // Characters that make up unary and binary operations.
-  string OPERATORS = "+-*/<>=&!:.";
+  static const string OPERATORS;
 
   // whitespace representatives
-  string WHITESPACE = " \t\n\r";
+  static const string WHITESPACE;
 
   string vomit(void); // gives a string of every token without changing state
 
@@ -63,11 +82,12 @@ class TokenStream {
   string source_name{""};
   InputStream *source;
   list<token> tokens;
-  vector<Position> starts;
+  list<Position> starts;
   // variable to manage parsing state
   int line{0};
   int column{1};
-  Position mark;
+  int offset{0};
+  Position mark{0, 1, 0};
 
   // Parser Helper functions
   void lexassert(char c);         // confirms that c is a valid char
@@ -114,6 +134,14 @@ class RunTimeError : public LexError {
     public:
   RunTimeError(string error_msg) : LexError(error_msg) {}
 };
+class LimitExceeded : public RunTimeError {
+    public:
+  LimitExceeded(string error_msg) : RunTimeError(error_msg) {}
+};
+class Timeout : public LimitExceeded {
+    public:
+  Timeout(string error_msg) : LimitExceeded(error_msg) {}
+};
 class ParseError : public LexError {
     public:
   ParseError(string error_msg) : LexError(error_msg) {}
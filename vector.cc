@@ -0,0 +1,365 @@
+// The vector builtins. When f is a lambda whose body is plain int
+// arithmetic on its parameter and literals (or ints it captured), map,
+// foldl, tabulate and filter run it over whole blocks of elements at once
+// instead of calling it per element.
+#include "builtin.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SML_SIMD_SUPPORTED 1
+#else
+#define SML_SIMD_SUPPORTED 0
+#endif
+
+// Elements worked on at a time, and the most operands a compiled lambda may
+// have pending
+const int BLOCK = 512;
+const int DEPTH = 8;
+
+// Lanes: applies an operator to n elements of a and b. Comparisons give -1
+// for true and 0 for false, and Not ignores b.
+using Lanes = void (*)(const int *a, const int *b, int *out, int n);
+
+// Kernels: one implementation of every operator. Arithmetic wraps around,
+// which is what the tree walker's int arithmetic does in practice.
+struct Kernels {
+  Lanes plus, minus, times, less, equals, negate;
+  int (*sum)(const int *a, int n);
+};
+
+#define SCALAR(name, expr)                                                     \
+  static void name(const int *a, const int *b, int *out, int n)                \
+  {                                                                            \
+    for (int i = 0; i < n; i++) {                                              \
+      unsigned x = a[i], y = b ? b[i] : 0;                                     \
+      (void)y;                                                                 \
+      out[i] = static_cast<int>(expr);                                         \
+    }                                                                          \
+  }
+
+SCALAR(plusScalar, x + y)
+SCALAR(minusScalar, x - y)
+SCALAR(timesScalar, x *y)
+SCALAR(lessScalar, int(x) < int(y) ? -1 : 0)
+SCALAR(equalsScalar, x == y ? -1 : 0)
+SCALAR(negateScalar, ~x)
+
+static int sumScalar(const int *a, int n)
+{
+  unsigned s = 0;
+  for (int i = 0; i < n; i++)
+    s += a[i];
+  return static_cast<int>(s);
+}
+
+static const Kernels SCALAR_KERNELS{plusScalar,   minusScalar,  timesScalar,
+                                    lessScalar,   equalsScalar, negateScalar,
+                                    sumScalar};
+
+#if SML_SIMD_SUPPORTED
+#define AVX2 __attribute__((target("avx2")))
+
+// eight lanes at a time, the rest by the scalar kernel
+#define VECTOR8(name, scalar, expr)                                            \
+  AVX2 static void name(const int *a, const int *b, int *out, int n)           \
+  {                                                                            \
+    int i = 0;                                                                 \
+    for (; i + 8 <= n; i += 8) {                                               \
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)); \
+      __m256i y = b ? _mm256_loadu_si256(                                      \
+                          reinterpret_cast<const __m256i *>(b + i))            \
+                    : x;                                                       \
+      (void)y;                                                                 \
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), expr);         \
+    }                                                                          \
+    scalar(a + i, b ? b + i : nullptr, out + i, n - i);                        \
+  }
+
+VECTOR8(plusAvx2, plusScalar, _mm256_add_epi32(x, y))
+VECTOR8(minusAvx2, minusScalar, _mm256_sub_epi32(x, y))
+VECTOR8(timesAvx2, timesScalar, _mm256_mullo_epi32(x, y))
+VECTOR8(lessAvx2, lessScalar, _mm256_cmpgt_epi32(y, x))
+VECTOR8(equalsAvx2, equalsScalar, _mm256_cmpeq_epi32(x, y))
+VECTOR8(negateAvx2, negateScalar,
+        _mm256_xor_si256(x, _mm256_set1_epi32(-1)))
+
+AVX2 static int sumAvx2(const int *a, int n)
+{
+  __m256i s = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    s = _mm256_add_epi32(
+        s, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+  alignas(32) int lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), s);
+  return sumScalar(lanes, 8) + sumScalar(a + i, n - i);
+}
+
+static const Kernels AVX2_KERNELS{plusAvx2,   minusAvx2,  timesAvx2, lessAvx2,
+                                  equalsAvx2, negateAvx2, sumAvx2};
+#endif
+
+static const Kernels &kernels(void)
+{
+#if SML_SIMD_SUPPORTED
+  if (useAvx2()) return AVX2_KERNELS;
+#endif
+  return SCALAR_KERNELS;
+}
+
+// Kernel: a lambda compiled for the kernels, if its body is simple enough.
+// The body is kept as steps in postfix order over a stack of blocks.
+class Kernel {
+    public:
+  enum Shape {
+    Ints,      // fn x => <arithmetic>
+    Predicate, // fn x => <arithmetic> < <arithmetic>, =, or `not` of one
+    Sum,       // fn p => <arithmetic on fst p> + snd p, either way around
+  };
+  bool compile(std::shared_ptr<SMLValue> f, Shape shape);
+  const int *run(const int *x, int n); // the body for n <= BLOCK elements
+
+    private:
+  enum Op { Arg, Const, Plus, Minus, Times, Less, Equals, Not };
+  struct Step {
+    Op op;
+    int n; // Const
+  };
+  bool arithmetic(std::shared_ptr<AstNode> node, int depth);
+  bool isArg(std::shared_ptr<AstNode> node);
+  bool isAccumulator(std::shared_ptr<AstNode> node);
+
+  SMLClos *clos{nullptr};
+  Shape shape{Ints};
+  std::vector<Step> steps;
+  std::vector<int> scratch; // DEPTH blocks
+};
+
+static std::shared_ptr<AstBranch> branch(std::shared_ptr<AstNode> n)
+{
+  return n->is_branch() ? std::static_pointer_cast<AstBranch>(n) : nullptr;
+}
+
+static bool isVar(std::shared_ptr<AstNode> n, std::string const &x)
+{
+  std::shared_ptr<AstBranch> b = branch(n);
+  return b && b->label() == Label::Var &&
+         std::static_pointer_cast<AstString>(b->get(0))->get_string() == x;
+}
+
+bool Kernel::isArg(std::shared_ptr<AstNode> node)
+{
+  if (shape != Sum) return isVar(node, clos->var);
+  std::shared_ptr<AstBranch> b = branch(node);
+  return b && b->label() == Label::First && isVar(b->get(0), clos->var);
+}
+
+bool Kernel::isAccumulator(std::shared_ptr<AstNode> node)
+{
+  std::shared_ptr<AstBranch> b = branch(node);
+  return b && b->label() == Label::Second && isVar(b->get(0), clos->var);
+}
+
+// Kernel::arithmetic: Compiles int arithmetic on the argument, literals and
+// captured ints, leaving its value at the given stack depth
+bool Kernel::arithmetic(std::shared_ptr<AstNode> node, int depth)
+{
+  std::shared_ptr<AstBranch> ast = branch(node);
+  if (!ast || depth >= DEPTH) return false;
+  if (isArg(ast)) {
+    steps.push_back({Arg, 0});
+    return true;
+  }
+  Label l = ast->label();
+  if (l == Label::Literal) {
+    if (ast->get(0)->label() != Label::Int) return false;
+    steps.push_back({Const, std::static_pointer_cast<AstLeaf>(ast->get(0))->val()});
+    return true;
+  }
+  if (l == Label::Var) {
+    std::string y = std::static_pointer_cast<AstString>(ast->get(0))->get_string();
+    if (y == clos->var || !clos->env.in_hold(y)) return false;
+    std::shared_ptr<SMLValue> v = clos->env.lookup(y);
+    if (v->type() != "Int") return false;
+    steps.push_back({Const, *std::static_pointer_cast<SMLInt>(v)});
+    return true;
+  }
+  Op op = l == Label::Plus    ? Plus
+          : l == Label::Minus ? Minus
+          : l == Label::Times ? Times
+                              : Arg;
+  if (op == Arg || !arithmetic(ast->get(0), depth) ||
+      !arithmetic(ast->get(1), depth + 1))
+    return false;
+  steps.push_back({op, 0});
+  return true;
+}
+
+bool Kernel::compile(std::shared_ptr<SMLValue> f, Shape shape_)
+{
+  if (f->type() != "Clos") return false;
+  clos = static_cast<SMLClos *>(f.get());
+  shape = shape_;
+  steps.clear();
+  std::shared_ptr<AstBranch> body = branch(clos->last);
+  if (!body) return false;
+  bool ok = false;
+  if (shape == Ints)
+    ok = arithmetic(body, 0);
+  else if (shape == Sum && body->label() == Label::Plus) {
+    if (isAccumulator(body->get(1)))
+      ok = arithmetic(body->get(0), 0);
+    else if (isAccumulator(body->get(0)))
+      ok = arithmetic(body->get(1), 0);
+  }
+  else if (shape == Predicate) {
+    bool negate = body->label() == Label::Not;
+    std::shared_ptr<AstBranch> cmp = negate ? branch(body->get(0)) : body;
+    if (cmp && (cmp->label() == Label::Less || cmp->label() == Label::Equals) &&
+        arithmetic(cmp->get(0), 0) && arithmetic(cmp->get(1), 1)) {
+      steps.push_back({cmp->label() == Label::Less ? Less : Equals, 0});
+      if (negate) steps.push_back({Not, 0});
+      ok = true;
+    }
+  }
+  if (ok) scratch.resize(DEPTH * BLOCK);
+  return ok;
+}
+
+const int *Kernel::run(const int *x, int n)
+{
+  const Kernels &k = kernels();
+  const int *slot[DEPTH];
+  int sp = 0;
+  for (Step &s : steps) {
+    int *out;
+    switch (s.op) {
+    case Arg:
+      slot[sp++] = x;
+      break;
+    case Const:
+      out = &scratch[sp * BLOCK];
+      std::fill(out, out + n, s.n);
+      slot[sp++] = out;
+      break;
+    case Not:
+      out = &scratch[(sp - 1) * BLOCK];
+      k.negate(slot[sp - 1], nullptr, out, n);
+      slot[sp - 1] = out;
+      break;
+    default:
+      out = &scratch[(sp - 2) * BLOCK];
+      Lanes op = s.op == Plus    ? k.plus
+                 : s.op == Minus ? k.minus
+                 : s.op == Times ? k.times
+                 : s.op == Less  ? k.less
+                                 : k.equals;
+      op(slot[sp - 2], slot[sp - 1], out, n);
+      slot[sp - 2] = out;
+      sp--;
+    }
+  }
+  return slot[0];
+}
+
+// element: What f returned for one element of map or tabulate
+static int element(BuiltinCall &call, std::shared_ptr<SMLValue> v)
+{
+  if (v->type() != "Int")
+    throw call.error("the function returned " + v->to_string_typed() +
+                     ", not an int,");
+  return *std::static_pointer_cast<SMLInt>(v);
+}
+
+// ints: Fills out[k] with f (from + k) for k < n, or f (x[k]) given x
+static void ints(BuiltinCall &call, std::shared_ptr<SMLClos> f, const int *x,
+                 int from, int *out, size_t n)
+{
+  Kernel kernel;
+  if (kernel.compile(f, Kernel::Ints)) {
+    int index[BLOCK];
+    for (size_t at = 0; at < n; at += BLOCK) {
+      int len = std::min<size_t>(BLOCK, n - at);
+      if (!x)
+        for (int i = 0; i < len; i++)
+          index[i] = from + int(at) + i;
+      const int *r = kernel.run(x ? x + at : index, len);
+      std::memcpy(out + at, r, len * sizeof(int));
+    }
+    return;
+  }
+  for (size_t k = 0; k < n; k++)
+    out[k] = element(call, f->eval(SMLInt::New(x ? x[k] : from + int(k))));
+}
+
+std::shared_ptr<SMLValue> vectorBuiltin(BuiltinCall &call)
+{
+  switch (call.builtin) {
+  case Builtin::Length:
+    return SMLInt::New(call.vec(0)->ints().size());
+  case Builtin::Sub: {
+    std::vector<int> &v = call.vec(0)->ints();
+    int i = call.integer(1);
+    if (i < 0 || size_t(i) >= v.size())
+      throw call.error("index " + std::to_string(i) +
+                       " out of range for length " + std::to_string(v.size()));
+    return SMLInt::New(v[i]);
+  }
+  case Builtin::Tabulate: {
+    int n = call.integer(0);
+    std::shared_ptr<SMLClos> f = call.fn(1);
+    if (n < 0) throw call.error("negative length " + std::to_string(n));
+    std::shared_ptr<SMLVector> out = SMLVector::New(n);
+    ints(call, f, nullptr, 0, out->ints().data(), n);
+    return out;
+  }
+  case Builtin::Map: {
+    std::shared_ptr<SMLClos> f = call.fn(0);
+    std::vector<int> &v = call.vec(1)->ints();
+    std::shared_ptr<SMLVector> out = SMLVector::New(v.size());
+    ints(call, f, v.data(), 0, out->ints().data(), v.size());
+    return out;
+  }
+  case Builtin::Foldl: {
+    std::shared_ptr<SMLClos> f = call.fn(0);
+    std::vector<int> &v = call.vec(2)->ints();
+    Kernel kernel;
+    if (call.args[1]->type() == "Int" && kernel.compile(f, Kernel::Sum)) {
+      unsigned s = call.integer(1);
+      for (size_t at = 0; at < v.size(); at += BLOCK) {
+        int len = std::min<size_t>(BLOCK, v.size() - at);
+        s += kernels().sum(kernel.run(v.data() + at, len), len);
+      }
+      return SMLInt::New(static_cast<int>(s));
+    }
+    std::shared_ptr<SMLValue> acc = call.args[1];
+    for (int x : v)
+      acc = f->eval(SMLPair::New(SMLInt::New(x), acc));
+    return acc;
+  }
+  default: { // Filter
+    std::shared_ptr<SMLClos> f = call.fn(0);
+    std::vector<int> &v = call.vec(1)->ints();
+    std::shared_ptr<SMLVector> out = SMLVector::New(v.size());
+    std::vector<int> &kept = out->ints();
+    size_t w = 0;
+    Kernel kernel;
+    if (kernel.compile(f, Kernel::Predicate))
+      for (size_t at = 0; at < v.size(); at += BLOCK) {
+        int len = std::min<size_t>(BLOCK, v.size() - at);
+        const int *keep = kernel.run(v.data() + at, len);
+        for (int i = 0; i < len; i++) { // branch free
+          kept[w] = v[at + i];
+          w -= keep[i];
+        }
+      }
+    else
+      for (int x : v)
+        if (*SMLBool::New(f->eval(SMLInt::New(x)))) kept[w++] = x;
+    kept.resize(w);
+    return out;
+  }
+  }
+}